@@ -0,0 +1,139 @@
+#ifndef __POLYGON_ALLOC_H
+#define __POLYGON_ALLOC_H
+
+// Heap allocation counting, per phase of the training loop.
+//
+// Off unless the program defines POLYGON_COUNT_ALLOCS before including
+// anything: then this header replaces the global operator new/delete
+// with counting versions, so it has to end up in exactly one translation
+// unit (every program here is a single one). ALLOC_PHASE(p) marks the
+// rest of a scope as phase p on the current thread; without counting it
+// expands to nothing.
+
+#ifdef POLYGON_COUNT_ALLOCS
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+enum class AllocPhase { other, policy, act, learn, record };
+
+constexpr std::size_t NALLOC_PHASES = 5;
+
+constexpr const char* ALLOC_PHASE_NAMES[NALLOC_PHASES] =
+	{"other", "policy", "act", "learn", "record"};
+
+struct AllocCounts
+{
+	std::atomic<std::uint64_t> count[NALLOC_PHASES];
+	std::atomic<std::uint64_t> bytes[NALLOC_PHASES];
+};
+
+inline AllocCounts& alloc_counts()
+{
+	static AllocCounts counts; // zero-initialized before any allocation
+	return counts;
+}
+
+inline int& alloc_phase()
+{
+	static thread_local int phase = 0;
+	return phase;
+}
+
+inline void alloc_reset()
+{
+	auto& c = alloc_counts();
+	for(auto i = 0; i < NALLOC_PHASES; i++) {
+		c.count[i] = 0;
+		c.bytes[i] = 0;
+	}
+}
+
+inline std::uint64_t alloc_total()
+{
+	std::uint64_t n = 0;
+	for(const auto& c: alloc_counts().count) {
+		n += c;
+	}
+	return n;
+}
+
+struct AllocPhaseScope
+{
+	int saved;
+
+	explicit AllocPhaseScope(AllocPhase p)
+		: saved(alloc_phase())
+	{
+		alloc_phase() = static_cast<int>(p);
+	}
+
+	~AllocPhaseScope()
+	{
+		alloc_phase() = saved;
+	}
+};
+
+#define ALLOC_PHASE(p) AllocPhaseScope alloc_phase_scope_(AllocPhase::p)
+
+inline void* counted_malloc(std::size_t n)
+{
+	auto& c = alloc_counts();
+	const auto p = alloc_phase();
+	c.count[p].fetch_add(1, std::memory_order_relaxed);
+	c.bytes[p].fetch_add(n, std::memory_order_relaxed);
+	return std::malloc(n ? n : 1);
+}
+
+void* operator new(std::size_t n)
+{
+	if(auto p = counted_malloc(n)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t n)
+{
+	return operator new(n);
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept
+{
+	return counted_malloc(n);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept
+{
+	return counted_malloc(n);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+#else
+
+#define ALLOC_PHASE(p)
+
+#endif
+
+#endif
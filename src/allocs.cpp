@@ -0,0 +1,83 @@
+// Counts heap allocations per tick of a headless Polygon once it has
+// warmed up. Fails unless the allocation-free learner (ApproxMLP) gets
+// through the measured ticks without a single one; the tiny-dnn learner
+// is measured for comparison only.
+#define POLYGON_COUNT_ALLOCS
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "alloc.h"
+#include "geom.h"
+#include "cacla.h"
+#include "polygon.h"
+
+void usage()
+{
+	std::cerr << "usage: allocs [--warmup N] [--ticks N] [--record FILE]\n";
+}
+
+template <template <std::size_t, std::size_t> class Approximator>
+std::uint64_t measure(const char* name, unsigned warmup, unsigned ticks,
+	const std::string& record)
+{
+	PolygonConfig config;
+	config.seed = 1;
+	Polygon<36, 2, Approximator> polygon("123", config);
+	if(!record.empty()) {
+		polygon.record_to(record);
+	}
+	polygon.run(warmup);
+
+	alloc_reset();
+	polygon.run(ticks);
+	std::uint64_t count[NALLOC_PHASES], bytes[NALLOC_PHASES];
+	for(auto i = 0; i < NALLOC_PHASES; i++) {
+		count[i] = alloc_counts().count[i];
+		bytes[i] = alloc_counts().bytes[i];
+	}
+	const auto total = alloc_total();
+
+	std::cout << name << ": " << total << " allocations in " << ticks
+			  << " ticks after " << warmup << " warmup ticks\n";
+	for(auto i = 0; i < NALLOC_PHASES; i++) {
+		std::cout << "  " << std::setw(8) << std::left << ALLOC_PHASE_NAMES[i]
+				  << std::right << std::setw(12) << count[i] << " allocs"
+				  << std::setw(14) << bytes[i] << " bytes"
+				  << std::setw(12) << std::fixed << std::setprecision(1)
+				  << double(count[i]) / ticks << " /tick\n";
+	}
+	return total;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned warmup = 1000;
+	unsigned ticks = 10000;
+	std::string record;
+
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto has_value = i + 1 < argc;
+		if(arg == "--warmup" && has_value) {
+			warmup = std::atoi(argv[++i]);
+		} else if(arg == "--ticks" && has_value) {
+			ticks = std::atoi(argv[++i]);
+		} else if(arg == "--record" && has_value) {
+			record = argv[++i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	measure<ApproxTiny>("tiny-dnn", warmup, ticks, record);
+	const auto n = measure<ApproxMLP>("mlp", warmup, ticks, record);
+	if(n > 0) {
+		std::cout << "FAIL: the mlp learner allocated in steady state\n";
+		return 1;
+	}
+	std::cout << "ok: no allocations in steady state\n";
+}
@@ -6,37 +6,66 @@
 
 #include <vector>
 #include <iostream>
+#include <random>
+#include <stdexcept>
 #include <doublefann.h>
 #include <tiny_dnn/tiny_dnn.h>
 
-struct Range
-{
-	Float lo = 0;
-	Float hi = 0;
-
-	constexpr Range() {}
-	constexpr Range(Float alo, Float ahi)
-		:lo(alo), hi(ahi) {}
-};
-
+#include "mlp.h"
+#include "shardgrad.h"
+#include "trace.h"
+
+// Approximators are templates on the input and output counts, all with
+// the same interface, so Cacla and Polygon take any of them:
+//
+//   A(ranges, hidden, learning_rate)   NI -> hidden -> 10 -> NO, tanh
+//                                      hidden layers, linear output
+//   call(x), call(x, res)              one input
+//   call_batch(in, n, out)             n rows of NI values into n rows of NO
+//   update(target, x)                  one incremental training step
+//   update_batch(targets, in, n)       one training step on n rows
+//   weights(), weights(dst), set_weights(w), max_q(), version
+//   use_workers(pool, shard)           data-parallel update_batch(), where
+//                                      the backend supports it
+//
+// call() is never thread-safe: other threads read a WeightStore.
+
+// FANN network. update() is FANN's incremental training, update_batch()
+// one fann_train_epoch() of batch_algorithm (RPROP unless set otherwise)
+// over the rows. Steepness is 1 so that the network computes the same
+// function as an MLPWeights, and the initial weights are drawn like
+// ApproxMLP's.
 template<std::size_t NI, std::size_t NO>
-struct Approx
+struct ApproxFann
 {
 	std::unique_ptr<fann, decltype(&fann_destroy)> net;
 	std::array<Range, NI> ranges;
 
 	const std::size_t n_hidden;
+	std::size_t version = 0; // bumped by every update()
 
 private:
 	mutable std::array<Float, NI> tmp_in;
 	mutable std::array<Float, NO> tmp_out;
+	std::unique_ptr<fann_train_data, decltype(&fann_destroy_train)> batch;
+	mutable std::vector<fann_connection> connections;
+	std::vector<std::size_t> sizes;
+	std::vector<unsigned> first_neuron; // of every layer, by FANN's numbering
+
+	static std::mt19937& init_gen()
+	{
+		static std::mt19937 gen(1);
+		return gen;
+	}
 
 public:
 	template<typename T>
-	Approx(const T& aranges,
-		int ahidden, double learning_rate)
-		: n_hidden(ahidden),
-		  net(nullptr, fann_destroy)
+	ApproxFann(const T& aranges,
+		int ahidden, double learning_rate,
+		fann_train_enum batch_algorithm = FANN_TRAIN_RPROP)
+		: net(nullptr, fann_destroy),
+		  n_hidden(ahidden),
+		  batch(nullptr, fann_destroy_train)
 	{
 		std::copy(aranges.begin(), aranges.begin() + NI, ranges.begin());
 		auto _net = std::unique_ptr<fann, decltype(&fann_destroy)>(
@@ -44,11 +73,31 @@ public:
 			, fann_destroy
 		);
 		net = std::move(_net);
+		if(!net) {
+			throw std::runtime_error("can't create FANN network");
+		}
 		fann_set_activation_function_hidden(net.get(), FANN_SIGMOID_SYMMETRIC);
 		fann_set_activation_function_output(net.get(), FANN_LINEAR);
-		fann_set_training_algorithm(net.get(), FANN_TRAIN_INCREMENTAL);
+		fann_set_activation_steepness_hidden(net.get(), 1.0);
+		fann_set_activation_steepness_output(net.get(), 1.0);
+		fann_set_training_algorithm(net.get(), batch_algorithm);
 		fann_set_learning_rate(net.get(), learning_rate);
-		fann_set_learning_momentum(net.get(), 0.0);
+		fann_set_learning_momentum(net.get(), 0.95);
+
+		const auto nl = fann_get_num_layers(net.get());
+		std::vector<unsigned> layers(nl), bias(nl);
+		fann_get_layer_array(net.get(), layers.data());
+		fann_get_bias_array(net.get(), bias.data());
+		auto first = 0u;
+		for(auto l = 0; l < nl; l++) {
+			sizes.push_back(layers[l]);
+			first_neuron.push_back(first);
+			first += layers[l] + bias[l];
+		}
+		connections.resize(fann_get_total_connections(net.get()));
+		fann_get_connection_array(net.get(), connections.data());
+		set_weights(MLPWeights::xavier(sizes, init_gen()));
+		version = 0;
 	}
 
 	template<typename X, typename R>
@@ -63,22 +112,115 @@ public:
 	std::array<Float, NO> call(const X& x) const
 	{
 		std::array<Float, NO> res;
-		std::copy(x.cbegin(), x.cbegin() + NI, tmp_in.begin());
-		auto p = fann_run(net.get(), const_cast<Float*>(tmp_in.data()));
-		std::copy(p, p + NO, res.begin());
+		call(x, res);
 		return res;
 	} 
 
+	void call_batch(const Float* in, std::size_t n, Float* out) const
+	{
+		for(auto r = 0; r < n; r++) {
+			auto p = fann_run(net.get(), const_cast<Float*>(in + r * NI));
+			std::copy(p, p + NO, out + r * NO);
+		}
+	}
+
 	template<typename T, typename X>
 	void update(const T& target, const X& x)
 	{
 		std::copy(x.cbegin(), x.cbegin() + NI, tmp_in.begin());
 		std::copy(std::cbegin(target), std::cbegin(target) + NO, tmp_out.begin()); 
-		fann_train(net.get(), const_cast<Float*>(tmp_in.data()),
-			const_cast<Float*>(tmp_out.data()));
+		TRACE_SCOPE("ApproxFann::fit");
+		fann_train(net.get(), tmp_in.data(), tmp_out.data());
+		version++;
 	}
 
-	//TODO: save, load, print
+	void update_batch(const Float* targets, const Float* in, std::size_t n)
+	{
+		if(n == 0) {
+			return;
+		}
+		if(!batch || batch->num_data < n) {
+			batch.reset(fann_create_train(n, NI, NO));
+			if(!batch) {
+				throw std::runtime_error("can't create FANN training data");
+			}
+		}
+		// FANN trains on the first num_data rows only
+		const auto capacity = batch->num_data;
+		for(auto r = 0; r < n; r++) {
+			std::copy(in + r * NI, in + (r + 1) * NI, batch->input[r]);
+			std::copy(targets + r * NO, targets + (r + 1) * NO, batch->output[r]);
+		}
+		batch->num_data = n;
+		TRACE_SCOPE("ApproxFann::fit");
+		fann_train_epoch(net.get(), batch.get());
+		batch->num_data = capacity;
+		version++;
+	}
+
+	// FANN trains on one thread
+	void use_workers(WorkerPool*, std::size_t = 32)
+	{}
+
+	MLPWeights weights() const
+	{
+		MLPWeights res;
+		weights(res);
+		return res;
+	}
+
+	void weights(MLPWeights& dst) const
+	{
+		fann_get_connection_array(net.get(), connections.data());
+		dst.sizes = sizes;
+		dst.w.resize(sizes.size() - 1);
+		dst.b.resize(sizes.size() - 1);
+		for(auto l = 0; l + 1 < sizes.size(); l++) {
+			dst.w[l].resize(sizes[l] * sizes[l + 1]);
+			dst.b[l].resize(sizes[l + 1]);
+		}
+		for(const auto& c: connections) {
+			weight_of(dst, c) = c.weight;
+		}
+	}
+
+	void set_weights(const MLPWeights& w)
+	{
+		if(w.sizes != sizes) {
+			throw std::runtime_error("ApproxFann::set_weights: layer sizes differ");
+		}
+		for(auto& c: connections) {
+			c.weight = weight_of(w, c);
+		}
+		fann_set_weight_array(net.get(), connections.data(), connections.size());
+		version++;
+	}
+
+	double max_q() const
+	{
+		fann_get_connection_array(net.get(), connections.data());
+		auto max_w = 0.0;
+		for(const auto& c: connections) {
+			max_w = std::max(max_w, std::fabs(c.weight));
+		}
+		return max_w;
+	}
+
+private:
+	// Where a FANN connection lives in an MLPWeights: the bias neuron of
+	// a layer comes after its regular ones
+	template <typename W>
+	auto weight_of(W& w, const fann_connection& c) const -> decltype((w.b[0][0]))
+	{
+		auto l = first_neuron.size() - 1;
+		while(c.to_neuron < first_neuron[l]) {
+			l--;
+		}
+		const auto i = c.to_neuron - first_neuron[l];
+		const auto k = c.from_neuron - first_neuron[l - 1];
+		const auto ni = sizes[l - 1];
+		return k == ni ? w.b[l - 1][i] : w.w[l - 1][i * ni + k];
+	}
 };
 
 using namespace tiny_dnn;
@@ -86,16 +228,18 @@ using namespace tiny_dnn::activation;
 using namespace tiny_dnn::layers;
 
 
-template <std::size_t ...LS>
 class MLPNet
 {
 	typedef activation::tanh actfun_t;
-	std::array<std::size_t, sizeof...(LS)> layer_sizes = {{LS...}};
-	std::array<std::shared_ptr<fc>, sizeof...(LS) - 1> layers;
-	std::array<std::shared_ptr<actfun_t>, sizeof...(LS) - 2> acs;
+	std::vector<std::size_t> layer_sizes;
+	std::vector<std::shared_ptr<fc>> layers;
+	std::vector<std::shared_ptr<actfun_t>> acs;
 	network<graph> m_net;
 public:
-	MLPNet()
+	explicit MLPNet(const std::vector<std::size_t>& alayer_sizes)
+		: layer_sizes(alayer_sizes),
+		  layers(alayer_sizes.size() - 1),
+		  acs(alayer_sizes.size() - 2)
 	{
 		for(auto i = 0; i < layer_sizes.size() - 1; i++) {
 			auto layer = std::make_shared<fc>(layer_sizes[i], layer_sizes[i+1]);
@@ -117,6 +261,64 @@ public:
 	{
 		return m_net;
 	}
+
+	const std::vector<std::size_t>& sizes() const
+	{
+		return layer_sizes;
+	}
+
+	// Copies the weights out of the fc layers (tiny-dnn keeps them
+	// input-major, MLPWeights output-major)
+	MLPWeights weights() const
+	{
+		MLPWeights res;
+		weights(res);
+		return res;
+	}
+
+	// Same into res, reusing its buffers when the sizes already match
+	void weights(MLPWeights& res) const
+	{
+		res.sizes = layer_sizes;
+		res.w.resize(layers.size());
+		res.b.resize(layers.size());
+		for(auto l = 0; l < layers.size(); l++) {
+			const auto ni = layer_sizes[l];
+			const auto no = layer_sizes[l + 1];
+			auto wb = layers[l]->weights();
+			const auto& w = *wb[0];
+			const auto& b = *wb[1];
+			auto& wl = res.w[l];
+			wl.resize(ni * no);
+			for(auto c = 0; c < ni; c++) {
+				for(auto i = 0; i < no; i++) {
+					wl[i * ni + c] = w[c * no + i];
+				}
+			}
+			res.b[l].assign(b.cbegin(), b.cend());
+		}
+	}
+
+	// Inverse of weights(); the layer sizes have to match
+	void set_weights(const MLPWeights& src)
+	{
+		if(src.sizes != layer_sizes) {
+			throw std::runtime_error("MLPNet::set_weights: layer sizes differ");
+		}
+		for(auto l = 0; l < layers.size(); l++) {
+			const auto ni = layer_sizes[l];
+			const auto no = layer_sizes[l + 1];
+			auto wb = layers[l]->weights();
+			auto& w = *wb[0];
+			auto& b = *wb[1];
+			for(auto c = 0; c < ni; c++) {
+				for(auto i = 0; i < no; i++) {
+					w[c * no + i] = src.w[l][i * ni + c];
+				}
+			}
+			std::copy(src.b[l].cbegin(), src.b[l].cend(), b.begin());
+		}
+	}
 };
 
 
@@ -180,17 +382,21 @@ struct ApproxTiny
 	const std::size_t n_hidden;
 
 	//mutable ResidualNet<NI, 12, NO> arch;
-	mutable MLPNet<NI, 18, 10, NO> arch;
+	mutable MLPNet arch;
 	momentum opt;
+	std::size_t version = 0; // bumped by every update()
 
 private:
 	mutable std::vector<vec_t> tmp_in;
 	mutable std::vector<vec_t> tmp_out;
+	std::vector<vec_t> batch_in;
+	std::vector<vec_t> batch_out;
 public:
 	template<typename T>
 	ApproxTiny(const T& aranges,
 		int ahidden, double learning_rate)
 		: n_hidden(ahidden),
+		  arch({NI, n_hidden, 10, NO}),
 		  tmp_in(1, vec_t(NI)),
 		  tmp_out(1, vec_t(NO))
 	{
@@ -238,11 +444,66 @@ public:
 
 		arch.net().set_netphase(net_phase::train);
 
+		TRACE_SCOPE("ApproxTiny::fit");
 		network<graph>& net = arch.net();
 		net.fit<mse>(opt, tmp_in, tmp_out,
 						1, //batch
 						1 //epochs
 					);
+		version++;
+	}
+
+	void call_batch(const Float* in, std::size_t n, Float* out) const
+	{
+		arch.net().set_netphase(net_phase::test);
+		for(auto r = 0; r < n; r++) {
+			std::copy(in + r * NI, in + (r + 1) * NI, tmp_in[0].begin());
+			auto p = arch.net().predict(tmp_in[0]);
+			std::copy(p.cbegin(), p.cend(), out + r * NO);
+		}
+	}
+
+	// One minibatch of n rows: tiny-dnn averages their gradients
+	void update_batch(const Float* targets, const Float* in, std::size_t n)
+	{
+		if(n == 0) {
+			return;
+		}
+		if(batch_in.size() != n) {
+			batch_in.resize(n, vec_t(NI));
+			batch_out.resize(n, vec_t(NO));
+		}
+		for(auto r = 0; r < n; r++) {
+			std::copy(in + r * NI, in + (r + 1) * NI, batch_in[r].begin());
+			std::copy(targets + r * NO, targets + (r + 1) * NO, batch_out[r].begin());
+		}
+
+		arch.net().set_netphase(net_phase::train);
+
+		TRACE_SCOPE("ApproxTiny::fit");
+		arch.net().fit<mse>(opt, batch_in, batch_out, n, 1);
+		version++;
+	}
+
+	// tiny-dnn's fit() has no sharded gradients to offer; ApproxMLP
+	// trains the same way and does
+	void use_workers(WorkerPool*, std::size_t = 32)
+	{}
+
+	MLPWeights weights() const
+	{
+		return arch.weights();
+	}
+
+	void weights(MLPWeights& dst) const
+	{
+		arch.weights(dst);
+	}
+
+	void set_weights(const MLPWeights& w)
+	{
+		arch.set_weights(w);
+		version++;
 	}
 
 	double max_q() const
@@ -264,4 +525,158 @@ public:
 	//TODO: save, load, print
 };
 
+// Same network and training rule as ApproxTiny (tanh hidden layers,
+// linear output, mse, momentum SGD one sample at a time), run on a plain
+// MLPWeights with buffers sized at construction, so that call() and
+// update() never touch the heap. Like ApproxTiny, call() is not
+// thread-safe; other threads read a WeightStore snapshot instead.
+template<std::size_t NI, std::size_t NO>
+struct ApproxMLP
+{
+	std::array<Range, NI> ranges;
+	const std::size_t n_hidden;
+	Float alpha;
+	Float mu = 0.95;
+	std::size_t version = 0; // bumped by every update()
+
+	static constexpr std::size_t batch_rows = 64;
+
+private:
+	MLPWeights net;
+	MLPGrad grad;
+	MLPGrad mom;
+	WorkerPool* workers = nullptr;
+	ShardedGrad sharded;
+	mutable std::vector<Float> scratch;
+	mutable std::array<Float, NI> tmp_in;
+	std::array<Float, NO> tmp_out;
+
+	// shared by all instances, like tiny-dnn's global random engine
+	static std::mt19937& init_gen()
+	{
+		static std::mt19937 gen(1);
+		return gen;
+	}
+
+public:
+	template<typename T>
+	ApproxMLP(const T& aranges,
+		int ahidden, double learning_rate)
+		: n_hidden(ahidden), alpha(learning_rate),
+		  net(MLPWeights::xavier({NI, n_hidden, 10, NO}, init_gen()))
+	{
+		std::copy(aranges.begin(), aranges.begin() + NI, ranges.begin());
+		grad.reset(net);
+		mom.reset(net);
+		scratch.resize(std::max(net.sizes[0] + n_hidden + 10 + NO + 2 * net.max_width(),
+			2 * batch_rows * net.max_width()));
+	}
+
+	template<typename X, typename R>
+	void call(const X& x, R& res) const
+	{
+		std::copy(x.cbegin(), x.cbegin() + NI, tmp_in.begin());
+		std::array<Float, NO> out;
+		net.forward(tmp_in.data(), 1, out.data(), scratch);
+		std::copy(out.cbegin(), out.cend(), res.begin());
+	}
+
+	template<typename X>
+	std::array<Float, NO> call(const X& x) const
+	{
+		std::array<Float, NO> res;
+		call(x, res);
+		return res;
+	}
+
+	template<typename T, typename X>
+	void update(const T& target, const X& x)
+	{
+		std::copy(x.begin(), x.begin() + NI, tmp_in.begin());
+		std::copy(std::cbegin(target), std::cbegin(target) + NO, tmp_out.begin());
+		TRACE_SCOPE("ApproxMLP::fit");
+		grad.zero();
+		mlp_backprop(net, tmp_in.data(), tmp_out.data(), 1.0, grad, scratch);
+		momentum_step(net, mom, grad, alpha, mu);
+		version++;
+	}
+
+	// batch_rows rows at a time, so the weights stream through the cache
+	// once per chunk rather than once per row
+	void call_batch(const Float* in, std::size_t n, Float* out) const
+	{
+		for(auto r = 0; r < n; r += batch_rows) {
+			net.forward(in + r * NI, std::min(n - r, batch_rows), out + r * NO, scratch);
+		}
+	}
+
+	// One momentum step on the mean gradient of the rows, like
+	// ApproxTiny's minibatches
+	void update_batch(const Float* targets, const Float* in, std::size_t n)
+	{
+		if(n == 0) {
+			return;
+		}
+		TRACE_SCOPE("ApproxMLP::fit");
+		if(workers) {
+			momentum_step(net, mom,
+				sharded.compute(*workers, net, targets, in, n, 1.0 / n), alpha, mu);
+			version++;
+			return;
+		}
+		grad.zero();
+		for(auto r = 0; r < n; r++) {
+			mlp_backprop(net, in + r * NI, targets + r * NO, 1.0 / n, grad, scratch);
+		}
+		momentum_step(net, mom, grad, alpha, mu);
+		version++;
+	}
+
+	// From now on update_batch() computes the gradient in shards of shard
+	// rows on pool (see ShardedGrad): the same weights come out for any
+	// number of threads, though not quite the ones of the serial sum.
+	// nullptr goes back to the calling thread alone.
+	void use_workers(WorkerPool* pool, std::size_t shard = 32)
+	{
+		workers = pool;
+		sharded = ShardedGrad(shard);
+	}
+
+	MLPWeights weights() const
+	{
+		return net;
+	}
+
+	// Copies into dst without allocating once dst has the right shape
+	void weights(MLPWeights& dst) const
+	{
+		dst = net;
+	}
+
+	void set_weights(const MLPWeights& w)
+	{
+		if(w.sizes != net.sizes) {
+			throw std::runtime_error("ApproxMLP::set_weights: layer sizes differ");
+		}
+		net = w;
+		version++;
+	}
+
+	double max_q() const
+	{
+		auto max_w = 0.0;
+		for(const auto& layer: {&net.w, &net.b}) {
+			for(const auto& v: *layer) {
+				for(auto w: v) {
+					max_w = std::max(max_w, std::fabs(w));
+				}
+			}
+		}
+		return max_w;
+	}
+};
+
+template<std::size_t NI, std::size_t NO>
+constexpr std::size_t ApproxMLP<NI, NO>::batch_rows;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,294 @@
+// Compares the approximator backends (tiny-dnn, mlp, FANN): inference
+// latency of call() and call_batch(), update() and update_batch()
+// throughput, how data-parallel update_batch() scales with threads, the
+// learning curves of headless Polygons started from the same seed,
+// learning one transition at a time or one tick at a time, and physics
+// steps per second as actions are held for more steps.
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geom.h"
+#include "cacla.h"
+#include "polygon.h"
+
+constexpr std::size_t NRAYS = 36;
+constexpr std::size_t NA = 2;
+
+void usage()
+{
+	std::cerr << "usage: approxbench [--rows N] [--batch N] [--ticks N]\n"
+			  << "                   [--chunks N] [--worlds N] [--threads N]\n"
+			  << "                   [--minibatch N] [--max-repeat N]\n";
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - t0).count();
+}
+
+template <template <std::size_t, std::size_t> class Approximator>
+void measure_speed(const char* name, std::size_t rows, std::size_t batch)
+{
+	Approximator<NRAYS, NA> net(Polygon<NRAYS, NA>::mk_state_ranges(),
+		PolygonConfig().hidden, 0.01);
+
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<Float> u(-0.9, 0.9);
+	std::vector<Float> in(rows * NRAYS), targets(rows * NA), out(rows * NA);
+	for(auto& x: in) {
+		x = u(gen);
+	}
+	for(auto& x: targets) {
+		x = u(gen);
+	}
+	std::array<Float, NRAYS> x;
+	std::array<Float, NA> y;
+	auto sink = 0.0;
+
+	auto t0 = std::chrono::steady_clock::now();
+	for(auto r = 0; r < rows; r++) {
+		std::copy(in.cbegin() + r * NRAYS, in.cbegin() + (r + 1) * NRAYS, x.begin());
+		net.call(x, y);
+		sink += y[0];
+	}
+	const auto call_ns = 1e9 * seconds_since(t0) / rows;
+
+	t0 = std::chrono::steady_clock::now();
+	for(auto r = 0; r < rows; r += batch) {
+		const auto n = std::min(batch, rows - r);
+		net.call_batch(in.data() + r * NRAYS, n, out.data() + r * NA);
+	}
+	const auto batch_ns = 1e9 * seconds_since(t0) / rows;
+	sink += out[0];
+
+	t0 = std::chrono::steady_clock::now();
+	for(auto r = 0; r < rows; r++) {
+		std::copy(in.cbegin() + r * NRAYS, in.cbegin() + (r + 1) * NRAYS, x.begin());
+		std::copy(targets.cbegin() + r * NA, targets.cbegin() + (r + 1) * NA, y.begin());
+		net.update(y, x);
+	}
+	const auto updates = rows / seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	for(auto r = 0; r < rows; r += batch) {
+		const auto n = std::min(batch, rows - r);
+		net.update_batch(targets.data() + r * NA, in.data() + r * NRAYS, n);
+	}
+	const auto batch_updates = rows / seconds_since(t0);
+
+	std::cout << std::setw(10) << std::left << name << std::right
+			  << std::fixed << std::setprecision(0)
+			  << std::setw(12) << call_ns
+			  << std::setw(12) << batch_ns
+			  << std::setw(14) << updates
+			  << std::setw(14) << batch_updates
+			  << "\n";
+	if(sink != sink) {
+		std::cout << "  (NaN output)\n";
+	}
+}
+
+// update_batch() of ApproxMLP on minibatches of n rows, with gradients
+// on 1, 2, 4... up to max_threads threads. The weights must come out the
+// same for every thread count.
+void measure_scaling(std::size_t rows, std::size_t n, unsigned max_threads)
+{
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<Float> u(-0.9, 0.9);
+	std::vector<Float> in(n * NRAYS), targets(n * NA);
+	for(auto& x: in) {
+		x = u(gen);
+	}
+	for(auto& x: targets) {
+		x = u(gen);
+	}
+	const auto start = ApproxMLP<NRAYS, NA>(Polygon<NRAYS, NA>::mk_state_ranges(),
+		PolygonConfig().hidden, 0.01).weights();
+
+	MLPWeights first;
+	double rate1 = 0;
+	for(auto nthreads = 1u; ; nthreads = std::min(2 * nthreads, max_threads)) {
+		ApproxMLP<NRAYS, NA> net(Polygon<NRAYS, NA>::mk_state_ranges(),
+			PolygonConfig().hidden, 0.01);
+		net.set_weights(start);
+		WorkerPool pool(nthreads);
+		net.use_workers(&pool);
+		std::size_t done = 0;
+		const auto t0 = std::chrono::steady_clock::now();
+		for(; done < rows; done += n) {
+			net.update_batch(targets.data(), in.data(), n);
+		}
+		const auto rate = done / seconds_since(t0);
+		if(nthreads == 1) {
+			first = net.weights();
+			rate1 = rate;
+		}
+		const auto w = net.weights();
+		std::cout << std::setw(10) << nthreads
+				  << std::fixed << std::setprecision(0) << std::setw(14) << rate
+				  << std::setprecision(2) << std::setw(10) << rate / rate1
+				  << std::setw(12) << (w.w == first.w && w.b == first.b ? "yes" : "NO")
+				  << "\n";
+		if(nthreads >= max_threads) {
+			break;
+		}
+	}
+}
+
+// Average reward per world and tick of every chunk
+template <template <std::size_t, std::size_t> class Approximator>
+std::vector<double> learning_curve(bool batched, std::size_t nworlds,
+	unsigned ticks, unsigned chunks)
+{
+	PolygonConfig config;
+	config.seed = 1;
+	config.nworlds = nworlds;
+	config.batch_learning = batched;
+	Polygon<NRAYS, NA, Approximator> polygon("123", config);
+	std::vector<double> res;
+	for(auto i = 0; i < chunks; i++) {
+		polygon.run(ticks / chunks);
+		res.push_back(polygon.telemetry.avg_reward);
+	}
+	return res;
+}
+
+// Headless Polygon on ApproxMLP, every action held for 1, 2, 4... up to
+// max_repeat physics steps: steps and decisions per second, and the
+// reward per world and physics step over the same number of steps
+void measure_repeat(std::size_t nworlds, unsigned ticks, unsigned max_repeat)
+{
+	for(auto k = 1u; ; k = std::min(2 * k, max_repeat)) {
+		PolygonConfig config;
+		config.seed = 1;
+		config.nworlds = nworlds;
+		config.action_repeat = k;
+		Polygon<NRAYS, NA, ApproxMLP> polygon("123", config);
+		const auto decisions = std::max(ticks / k, 1u);
+		const auto t0 = std::chrono::steady_clock::now();
+		polygon.run(decisions);
+		const auto seconds = seconds_since(t0);
+		// k steps per decision: slightly more than taken, as actions are
+		// cut short where episodes end
+		std::cout << std::setw(8) << k
+				  << std::fixed << std::setprecision(0)
+				  << std::setw(14) << nworlds * decisions * k / seconds
+				  << std::setw(14) << nworlds * decisions / seconds;
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(3) << std::setw(12)
+				  << polygon.telemetry.avg_reward << "\n";
+		if(k >= max_repeat) {
+			break;
+		}
+	}
+}
+
+template <template <std::size_t, std::size_t> class Approximator>
+void print_curves(const char* name, std::size_t nworlds, unsigned ticks,
+	unsigned chunks)
+{
+	for(auto batched: {false, true}) {
+		const auto t0 = std::chrono::steady_clock::now();
+		const auto curve = learning_curve<Approximator>(batched, nworlds,
+			ticks, chunks);
+		const auto seconds = seconds_since(t0);
+		std::cout << std::setw(10) << std::left << name
+				  << std::setw(8) << (batched ? "batch" : "step") << std::right
+				  << std::fixed << std::setprecision(1)
+				  << std::setw(8) << seconds << "s";
+		// general notation, a diverging learner shouldn't break the columns
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(3);
+		for(auto r: curve) {
+			std::cout << ' ' << std::setw(9) << r;
+		}
+		std::cout << "\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t rows = 20000;
+	std::size_t batch = 10;
+	unsigned ticks = 5000;
+	unsigned chunks = 10;
+	std::size_t nworlds = 10;
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	std::size_t minibatch = 1024;
+	unsigned max_repeat = 8;
+
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto has_value = i + 1 < argc;
+		if(arg == "--rows" && has_value) {
+			rows = std::atoi(argv[++i]);
+		} else if(arg == "--batch" && has_value) {
+			batch = std::atoi(argv[++i]);
+		} else if(arg == "--ticks" && has_value) {
+			ticks = std::atoi(argv[++i]);
+		} else if(arg == "--chunks" && has_value) {
+			chunks = std::atoi(argv[++i]);
+		} else if(arg == "--worlds" && has_value) {
+			nworlds = std::atoi(argv[++i]);
+		} else if(arg == "--threads" && has_value) {
+			threads = std::atoi(argv[++i]);
+		} else if(arg == "--minibatch" && has_value) {
+			minibatch = std::atoi(argv[++i]);
+		} else if(arg == "--max-repeat" && has_value) {
+			max_repeat = std::atoi(argv[++i]);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if(rows == 0 || batch == 0 || chunks == 0 || threads == 0 || minibatch == 0
+		|| max_repeat == 0) {
+		usage();
+		return 1;
+	}
+
+	try {
+		std::cout << "speed (" << NRAYS << " inputs, " << NA << " outputs, batches of "
+				  << batch << ")\n"
+				  << std::setw(10) << std::left << "backend" << std::right
+				  << std::setw(12) << "call ns"
+				  << std::setw(12) << "batch ns"
+				  << std::setw(14) << "updates/s"
+				  << std::setw(14) << "batch rows/s" << "\n";
+		measure_speed<ApproxTiny>("tiny-dnn", rows, batch);
+		measure_speed<ApproxMLP>("mlp", rows, batch);
+		measure_speed<ApproxFann>("fann", rows, batch);
+
+		std::cout << "\ndata-parallel mlp update_batch(), minibatches of " << minibatch
+				  << "\n"
+				  << std::setw(10) << "threads"
+				  << std::setw(14) << "rows/s"
+				  << std::setw(10) << "speedup"
+				  << std::setw(12) << "same w" << "\n";
+		measure_scaling(rows, minibatch, threads);
+
+		std::cout << "\nreward per world and tick, " << ticks << " ticks of "
+				  << nworlds << " worlds in " << chunks << " chunks, seed 1\n";
+		print_curves<ApproxTiny>("tiny-dnn", nworlds, ticks, chunks);
+		print_curves<ApproxMLP>("mlp", nworlds, ticks, chunks);
+		print_curves<ApproxFann>("fann", nworlds, ticks, chunks);
+
+		std::cout << "\naction repeat, mlp, " << ticks << " physics steps of "
+				  << nworlds << " worlds\n"
+				  << std::setw(8) << "repeat"
+				  << std::setw(14) << "steps/s"
+				  << std::setw(14) << "decisions/s"
+				  << std::setw(12) << "reward" << "\n";
+		measure_repeat(nworlds, ticks, max_repeat);
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+}
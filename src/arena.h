@@ -0,0 +1,250 @@
+#ifndef __POLYGON_ARENA_H
+#define __POLYGON_ARENA_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "geom.h"
+
+// Bodies of cars sharing one track, so that they can see and bump into
+// each other.
+//
+// Cars are hashed by the cell of their center in an unbounded uniform
+// grid. Cells map to a power-of-two table of buckets, each an intrusive
+// doubly linked list of cars, so a car that changes cells moves in O(1)
+// and nothing allocates once the arena is built. A query looks at the
+// cells around a point only, and cars from other cells sharing a bucket
+// are skipped by their cell coordinates. With cells about a car long,
+// queries cost the same however many cars there are, as long as they
+// don't all crowd into a few cells.
+//
+// A body is the 4 sections of a car's outline (Car::path); ids are
+// handed out by add() in order.
+class CarArena
+{
+public:
+	typedef std::array<Sect, 4> Body;
+
+	// reach: the largest distance from a car's center to its body
+	CarArena(std::size_t capacity, Float areach = 1.75, Float acell = 4.0)
+		: reach(areach), cell(acell)
+	{
+		auto nbuckets = std::size_t(1);
+		while(nbuckets < 2 * capacity) {
+			nbuckets *= 2;
+		}
+		heads.assign(nbuckets, -1);
+		bodies.reserve(capacity);
+		centers.reserve(capacity);
+		cells.reserve(capacity);
+		next.reserve(capacity);
+		prev.reserve(capacity);
+	}
+
+	std::size_t size() const
+	{
+		return bodies.size();
+	}
+
+	template <typename Sects>
+	std::uint32_t add(const Sects& body)
+	{
+		const auto id = static_cast<std::uint32_t>(bodies.size());
+		bodies.emplace_back();
+		centers.emplace_back();
+		cells.emplace_back(Cell{0, 0});
+		next.push_back(-1);
+		prev.push_back(-1);
+		set_body(id, body);
+		cells[id] = cell_of(centers[id]);
+		link(id);
+		return id;
+	}
+
+	// After car id moved
+	template <typename Sects>
+	void update(std::uint32_t id, const Sects& body)
+	{
+		set_body(id, body);
+		const auto c = cell_of(centers[id]);
+		if(c.x != cells[id].x || c.y != cells[id].y) {
+			unlink(id);
+			cells[id] = c;
+			link(id);
+		}
+	}
+
+	// Whether body overlaps any car but id
+	template <typename Sects>
+	bool hits(std::uint32_t id, const Sects& body) const
+	{
+		auto res = false;
+		for_near(id, body, 0.0, [&](std::uint32_t j) {
+			for(const auto& s: body) {
+				for(const auto& o: bodies[j]) {
+					if(intersect(s, o, false).dist >= 0.0) {
+						res = true;
+						return false;
+					}
+				}
+			}
+			return true;
+		});
+		return res;
+	}
+
+	// Whether body comes closer than dist to any car but id
+	template <typename Sects>
+	bool within(std::uint32_t id, const Sects& body, Float dist) const
+	{
+		auto res = false;
+		for_near(id, body, dist, [&](std::uint32_t j) {
+			for(const auto& s: body) {
+				for(const auto& o: bodies[j]) {
+					if(::within(s, o, dist)) {
+						res = true;
+						return false;
+					}
+				}
+			}
+			return true;
+		});
+		return res;
+	}
+
+	// Shortens the hit distances along rays (p0 = origin, p1 = unit
+	// direction) to the bodies of other cars up to range away
+	template <typename Rays, typename Dists>
+	void cast(std::uint32_t id, const Rays& rays, Float range,
+		Dists& dists) const
+	{
+		const auto& o = rays[0].p0;
+		for_cells(o, range + reach, [&](std::uint32_t j) {
+			if(j == id) {
+				return true;
+			}
+			const auto d = centers[j] - o;
+			if(dot(d, d) > (range + reach) * (range + reach)) {
+				return true;
+			}
+			for(auto i = 0; i < rays.size(); i++) {
+				for(const auto& s: bodies[j]) {
+					const auto t = ray_dist(rays[i], s);
+					if(t >= 0.0 && (dists[i] < 0.0 || t < dists[i])) {
+						dists[i] = t;
+					}
+				}
+			}
+			return true;
+		});
+	}
+
+	const Body& body(std::uint32_t id) const
+	{
+		return bodies[id];
+	}
+
+private:
+	struct Cell
+	{
+		std::int64_t x, y;
+	};
+
+	template <typename Sects>
+	void set_body(std::uint32_t id, const Sects& body)
+	{
+		auto c = Pt();
+		for(auto k = 0; k < 4; k++) {
+			bodies[id][k] = body[k];
+			c = c + body[k].p0;
+		}
+		centers[id] = 0.25 * c;
+	}
+
+	Cell cell_of(const Pt& p) const
+	{
+		return Cell{static_cast<std::int64_t>(std::floor(p.x / cell)),
+			static_cast<std::int64_t>(std::floor(p.y / cell))};
+	}
+
+	std::size_t bucket(std::int64_t x, std::int64_t y) const
+	{
+		const auto h = std::uint64_t(x) * 0x9E3779B97F4A7C15ull
+			^ std::uint64_t(y) * 0xC2B2AE3D27D4EB4Full;
+		return (h ^ (h >> 29)) & (heads.size() - 1);
+	}
+
+	void link(std::uint32_t id)
+	{
+		const auto b = bucket(cells[id].x, cells[id].y);
+		prev[id] = -1;
+		next[id] = heads[b];
+		if(heads[b] >= 0) {
+			prev[heads[b]] = id;
+		}
+		heads[b] = id;
+	}
+
+	void unlink(std::uint32_t id)
+	{
+		if(prev[id] >= 0) {
+			next[prev[id]] = next[id];
+		} else {
+			heads[bucket(cells[id].x, cells[id].y)] = next[id];
+		}
+		if(next[id] >= 0) {
+			prev[next[id]] = prev[id];
+		}
+	}
+
+	// f(car) for the cars whose center may be within r of p, until f
+	// returns false
+	template <typename F>
+	void for_cells(const Pt& p, Float r, F&& f) const
+	{
+		const auto lo = cell_of(p - Pt(r, r));
+		const auto hi = cell_of(p + Pt(r, r));
+		for(auto y = lo.y; y <= hi.y; y++) {
+			for(auto x = lo.x; x <= hi.x; x++) {
+				for(auto j = heads[bucket(x, y)]; j >= 0; j = next[j]) {
+					if(cells[j].x == x && cells[j].y == y && !f(j)) {
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	// f(car) for the cars but id whose bodies may come within dist of body
+	template <typename Sects, typename F>
+	void for_near(std::uint32_t id, const Sects& body, Float dist, F&& f) const
+	{
+		auto c = Pt();
+		for(auto k = 0; k < 4; k++) {
+			c = c + body[k].p0;
+		}
+		c = 0.25 * c;
+		const auto r = 2 * reach + dist;
+		for_cells(c, r, [&](std::uint32_t j) {
+			if(j == id) {
+				return true;
+			}
+			const auto d = centers[j] - c;
+			return dot(d, d) > r * r || f(j);
+		});
+	}
+
+	Float reach;
+	Float cell;
+	std::vector<std::int32_t> heads;
+	std::vector<Body> bodies;
+	std::vector<Pt> centers;
+	std::vector<Cell> cells;
+	std::vector<std::int32_t> next;
+	std::vector<std::int32_t> prev;
+};
+
+#endif
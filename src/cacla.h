@@ -8,10 +8,14 @@
 #include <random>
 #include <ctime>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "geom.h"
 #include "approx.h"
+#include "trace.h"
 
 template <std::size_t NA>
 struct CaclaState
@@ -24,21 +28,45 @@ struct CaclaState
 	double var;
 };
 
-template <std::size_t NS, std::size_t NA>
+// TD errors seen by Cacla::step() since the last reset, for telemetry
+struct TdStats
+{
+	std::uint64_t count = 0;
+	double sum = 0;
+	double sum_sq = 0;
+	double max_abs = 0;
+	std::uint64_t actor_updates = 0;
+
+	void add(double td_error)
+	{
+		count++;
+		sum += td_error;
+		sum_sq += td_error * td_error;
+		max_abs = std::max(max_abs, std::fabs(td_error));
+	}
+};
+
+// Approximator is ApproxTiny, ApproxMLP (allocation-free) or ApproxFann;
+// see approx.h for what they have in common
+template <std::size_t NS, std::size_t NA,
+	template <std::size_t, std::size_t> class Approximator = ApproxTiny>
 struct Cacla
 {
-	ApproxTiny<NS, 1> V;
-	ApproxTiny<NS, NA> Ac;
+	Approximator<NS, 1> V;
+	Approximator<NS, NA> Ac;
 	CaclaState<NA> state;
 	std::mt19937 gen;
+	std::normal_distribution<Float> noise;
+	TdStats td_stats;
 
 	template <typename T>
 	Cacla(const T& state_ranges,
 		int hidden,
-		double gamma, double alpha, double beta, double sigma)
+		double gamma, double alpha, double beta, double sigma,
+		unsigned seed = time(0))
 		: V(state_ranges, hidden, alpha),
 		  Ac(state_ranges, hidden, alpha),
-		  gen(time(0)),
+		  gen(seed),
 		  state{ std::array<Float, NA>(),
 			alpha, beta, gamma, sigma, 1.0 /*=var*/}
 	{}
@@ -46,10 +74,15 @@ struct Cacla
 	template <typename T>
 	std::array<Float, NA> get_action(const T& st)
 	{
-		const auto mu = Ac.call(st);
+		return sample_action(Ac.call(st));
+	}
+
+	// Exploration around a mean action, e.g. one computed from a weights
+	// snapshot on another thread. Only touches gen and sigma, never V/Ac.
+	std::array<Float, NA> sample_action(const std::array<Float, NA>& mu)
+	{
 		for(auto i = 0; i < mu.size(); i++) {
-			std::normal_distribution<Float> nd(mu[i], state.sigma);
-			state.action[i] = nd(gen);	
+			state.action[i] = mu[i] + state.sigma * noise(gen);
 		}
 		
 		if(state.sigma > 0.1) {
@@ -59,17 +92,29 @@ struct Cacla
 		return state.action;
 	}
 
+	// Discount of a state `steps` environment steps ahead
+	double discount(unsigned steps) const
+	{
+		return steps == 1 ? state.gamma : std::pow(state.gamma, steps);
+	}
+
+	// A transition may span several environment steps with the action
+	// held (see PolygonConfig::action_repeat): reward is then their
+	// discounted sum, and new_state is discounted by gamma^steps
 	template <typename OST, typename NST, typename A>
 	void step(const OST& old_state,
 			const NST& new_state,
 			const A& action,
-			double reward)
+			double reward,
+			unsigned steps = 1)
 	{
+		TRACE_SCOPE("Cacla::step");
 		auto old_state_v = V.call(old_state);
 		auto new_state_v = V.call(new_state);
-		auto target = std::array<Float, 1>{{reward + state.gamma * new_state_v[0]}}; // ??? why ...[0] ???
+		auto target = std::array<Float, 1>{{reward + discount(steps) * new_state_v[0]}}; // ??? why ...[0] ???
 		auto td_error = target[0] - old_state_v[0];
 		V.update(target, old_state);
+		td_stats.add(td_error);
 		if(td_error > 0) {
 			state.var = (1 - state.beta) * state.var
 				+ state.beta * td_error * td_error;
@@ -80,10 +125,124 @@ struct Cacla
 			for(auto i = 0; i < n; i++) {
 				Ac.update(action, old_state);
 			}
+			td_stats.actor_updates += n;
+		}
+	}
+
+	// step() for a whole batch of transitions (with members s, new_s,
+	// action, reward and steps), gathered into rows for the pointer version
+	template <typename Transitions>
+	void step_batch(const Transitions& transitions)
+	{
+		const auto n = transitions.size();
+		batch.resize(n);
+		for(auto i = 0; i < n; i++) {
+			const auto& tr = transitions[i];
+			std::copy(tr.s.cbegin(), tr.s.cend(), batch.s.begin() + i * NS);
+			std::copy(tr.new_s.cbegin(), tr.new_s.cend(), batch.new_s.begin() + i * NS);
+			std::copy(std::cbegin(tr.action), std::cbegin(tr.action) + NA,
+				batch.actions.begin() + i * NA);
+			batch.rewards[i] = tr.reward;
+			batch.steps[i] = tr.steps;
+		}
+		step_batch(batch.s.data(), batch.new_s.data(), batch.actions.data(),
+			batch.rewards.data(), n, batch.steps.data());
+	}
+
+	// step() for n transitions given as rows (NS states, NA actions),
+	// with one batched update of V and one of Ac. Every value comes from
+	// V as it was before the batch, and each actor target is repeated as
+	// often as step() would train on it. steps, when given, holds the
+	// environment steps of every transition (see step()).
+	void step_batch(const Float* s, const Float* new_s, const Float* actions,
+		const Float* rewards, std::size_t n, const unsigned* steps = nullptr)
+	{
+		TRACE_SCOPE("Cacla::step_batch");
+		batch.resize_values(n);
+		V.call_batch(s, n, batch.v_old.data());
+		V.call_batch(new_s, n, batch.v_new.data());
+
+		batch.ac_s.clear();
+		batch.ac_targets.clear();
+		for(auto i = 0; i < n; i++) {
+			batch.v_targets[i] = rewards[i]
+				+ (steps ? discount(steps[i]) : state.gamma) * batch.v_new[i];
+			const auto td_error = batch.v_targets[i] - batch.v_old[i];
+			td_stats.add(td_error);
+			if(td_error > 0) {
+				state.var = (1 - state.beta) * state.var
+					+ state.beta * td_error * td_error;
+				const auto k = std::ceil(td_error / std::sqrt(state.var));
+				for(auto j = 0; j < k; j++) {
+					batch.ac_s.insert(batch.ac_s.end(), s + i * NS, s + (i + 1) * NS);
+					batch.ac_targets.insert(batch.ac_targets.end(),
+						actions + i * NA, actions + (i + 1) * NA);
+				}
+				td_stats.actor_updates += k;
+			}
 		}
+		V.update_batch(batch.v_targets.data(), s, n);
+		Ac.update_batch(batch.ac_targets.data(), batch.ac_s.data(),
+			batch.ac_targets.size() / NA);
 	}
 
-	// TODO: save, load, print, v_fn, ac_fn
+	template <typename T>
+	double v_fn(const T& st) const
+	{
+		return V.call(st)[0];
+	}
+
+	template <typename T>
+	std::array<Float, NA> ac_fn(const T& st) const
+	{
+		return Ac.call(st);
+	}
+
+	// V and Ac weights, e.g. pretrained offline
+	void save(const std::string& path) const
+	{
+		save_weights(path, {V.weights(), Ac.weights()});
+	}
+
+	void load(const std::string& path)
+	{
+		const auto nets = load_weights(path);
+		if(nets.size() != 2) {
+			throw std::runtime_error("expected V and Ac weights in " + path);
+		}
+		V.set_weights(nets[0]);
+		Ac.set_weights(nets[1]);
+	}
+
+	// TODO: print
+
+private:
+	// Buffers of step_batch(), grown to the largest batch seen
+	struct Batch
+	{
+		std::vector<Float> s, new_s, actions, rewards;
+		std::vector<unsigned> steps;
+		std::vector<Float> v_old, v_new, v_targets;
+		std::vector<Float> ac_s, ac_targets;
+
+		void resize(std::size_t n)
+		{
+			s.resize(n * NS);
+			new_s.resize(n * NS);
+			actions.resize(n * NA);
+			rewards.resize(n);
+			steps.resize(n);
+		}
+
+		void resize_values(std::size_t n)
+		{
+			v_old.resize(n);
+			v_new.resize(n);
+			v_targets.resize(n);
+		}
+	};
+
+	Batch batch;
 };
 
 #endif
\ No newline at end of file
@@ -1,12 +1,17 @@
 #ifndef __POLYGON_CAR_H
 #define __POLYGON_CAR_H
 
+#include <algorithm>
 #include <vector>
 #include <cmath>
 #include <memory>
 #include <iostream>
 
+#include "arena.h"
 #include "geom.h"
+#include "grid.h"
+#include "sensors.h"
+#include "trace.h"
 
 constexpr double powi(double x, int n)
 {
@@ -17,7 +22,8 @@ constexpr double powi(double x, int n)
 	return res;
 }
 
-template <std::size_t NRAYS>
+// Layout: where the rays look, see sensors.h
+template <std::size_t NRAYS, typename Layout = UniformRays>
 struct Car 
 {
 	Pt center;
@@ -26,17 +32,25 @@ struct Car
 	double base, length, width;
 	double wheels_angle = 0;
 	double speed = 0;
+	double substep_travel = 0.25; // longest move between two overlap tests
+	double max_substeps = 64;     // beyond that substeps get longer
+	double max_lookahead = 4.0;   // longer moves always take substeps
 
 	std::array<Sect, NRAYS> rays;
 
 	Figure path;
 
-	std::shared_ptr<Figure> walls;
-	std::array<Isx, NRAYS> isxs;
-	std::array<Isx, NRAYS> self_isxs;
+	std::shared_ptr<const Figure> walls;
+	std::shared_ptr<const SectGrid> grid; // optional index over walls
+	CarArena* arena = nullptr; // other cars on the track, if shared
+	std::uint32_t arena_id = 0;
+	double arena_range = 12.0; // how far other cars are seen
+	std::array<Float, NRAYS> dists;      // from the body to what the rays hit
+	std::array<Float, NRAYS> self_dists; // from the center to the body
+	std::array<Float, NRAYS> limits;     // how far rays look from the center
 
 	Car(const Pt& acenter, const Pt& acourse,
-		std::shared_ptr<Figure> awalls,
+		std::shared_ptr<const Figure> awalls,
 		double alength = 3.0, double awidth = 1.6)
 		: center(acenter), course(acourse), walls(awalls),
 		  length(alength), width(awidth)
@@ -44,7 +58,7 @@ struct Car
 		base = alength;
 		recalc_rays();
 		recalc_path();
-		calc_self_isxs();
+		calc_self_dists();
 	}
 
 	void set_pos(const Pt& acenter, const Pt& acourse)
@@ -53,6 +67,22 @@ struct Car
 		course = acourse;
 		recalc_rays();
 		recalc_path();
+		if(arena) {
+			arena->update(arena_id, body());
+		}
+	}
+
+	// Joins a shared track; the car is seen by and collides with the
+	// other cars of the arena from now on
+	void join(CarArena& aarena)
+	{
+		arena = &aarena;
+		arena_id = arena->add(body());
+	}
+
+	const std::vector<Sect>& body() const
+	{
+		return path.paths[0].sects;
 	}
 
 	// TODO: unused function?
@@ -84,56 +114,164 @@ struct Car
 		return std::fabs(speed - action[0]);
 	}
 
+	// Whether the car moved, see move_or_stop()
 	template <typename A>
-	void act(const A& action)
+	bool act(const A& action, double dt = 0.1)
 	{
 		speed = val_of_action(action[0]);
 		wheels_angle = M_PI / 4.0 * val_of_action(action[1]);
-		move_or_stop(0.1);
+		return move_or_stop(dt);
 	}
 
-	void calc_self_isxs()
+	void calc_self_dists()
 	{
-		intersect(rays, path, -1.0, self_isxs);
+		ray_dists(rays, path, self_dists);
+		const auto& table = RayDirs<Layout, NRAYS>::table;
+		for(auto i = 0; i < NRAYS; i++) {
+			limits[i] = table[i].range > 0 ? self_dists[i] + table[i].range : 1.0e20;
+		}
 	}
 
 	void recalc_rays()
 	{
-		recalc_rays_a(rays, center, course);
+		place_rays<Layout>(rays, center, course);
 	}
 
+	// Rewrites the sections of the path in place after the first call,
+	// so that moving the car doesn't allocate
 	void recalc_path()
 	{
 		const auto l = 0.5 * length * course;
 		const auto w = 0.5 * course.rperp() * width;
-		path = Figure::closed_path(std::vector<Pt>{center + l - w,
-									center + l + w,
-									center - l + w,
-									center - l - w});
+		const Pt corners[4] = {center + l - w,
+							   center + l + w,
+							   center - l + w,
+							   center - l - w};
+		if(path.paths.size() != 1 || path.paths[0].sects.size() != 4) {
+			path = Figure::closed_path(std::vector<Pt>(corners, corners + 4));
+			return;
+		}
+		auto& sects = path.paths[0].sects;
+		for(auto k = 0; k < 4; k++) {
+			sects[k] = Sect(corners[k], corners[(k + 1) % 4]);
+		}
 	}
 
-	void move_or_stop(double dt)
+	// Moves for dt, stopping short of the walls and other cars. Far from
+	// them the car moves in one go without any overlap test. Otherwise it
+	// moves in substeps of at most substep_travel, so consecutive bodies
+	// overlap and no wall fits between them (up to max_substeps of them,
+	// beyond which substeps get longer). A hit is narrowed down by
+	// bisection, and the car stops just short of the contact. Returns
+	// whether the pose changed at all: a car scraping along a wall moves
+	// and stops, a wedged one doesn't move.
+	bool move_or_stop(double dt)
 	{
-		const auto stored_center = center;
-		const auto stored_course = course;
-		mv(dt);
-		recalc_path();
-		if(intersected(path, *walls)) {
-			center = stored_center;
-			course = stored_course;
-			speed = 0.0;
-            // TODO: check, probably we forgot to recalculate back rays
-            // (surely, we should restore saved rays, not recalculate them)
-            // TODO: the same with path
+		TRACE_SCOPE("Car::move_or_stop");
+		const auto travel = max_travel(dt);
+		const auto near = travel >= max_lookahead
+			|| (grid ? within(path, *grid, travel) : within(path, *walls, travel))
+			|| (arena && arena->within(arena_id, body(), travel));
+		if(!near) {
+			mv(dt);
 			recalc_path();
-		} else {
+			if(arena) {
+				arena->update(arena_id, body());
+			}
 			recalc_rays();
-			intersect(rays, *walls, -1.0, isxs);
-			for(auto i = 0; i < isxs.size(); i ++) {
-				if(isxs[i].dist >= 0) {
-					isxs[i].dist -= self_isxs[i].dist;
+			sense();
+			return true;
+		}
+
+		const auto n = std::min(max_substeps,
+			std::max(1.0, std::ceil(travel / substep_travel)));
+		const auto h = dt / n;
+		auto moved = false;
+		for(auto i = 0; i < n; i++) {
+			const auto stored_center = center;
+			const auto stored_course = course;
+			mv(h);
+			recalc_path();
+			if(!collides()) {
+				moved = true;
+				continue;
+			}
+			auto lo = 0.0, hi = h;
+			for(auto k = 0; k < 4; k++) {
+				const auto mid = 0.5 * (lo + hi);
+				center = stored_center;
+				course = stored_course;
+				mv(mid);
+				recalc_path();
+				if(collides()) {
+					hi = mid;
+				} else {
+					lo = mid;
 				}
 			}
+			center = stored_center;
+			course = stored_course;
+			if(lo > 0.0) {
+				mv(lo);
+				moved = true;
+			}
+			recalc_path();
+			speed = 0.0;
+			break;
+		}
+		if(moved && arena) {
+			arena->update(arena_id, body());
+		}
+		// stuck against a wall the old readings still hold, unless other
+		// cars move around
+		if(moved || arena) {
+			recalc_rays();
+			sense();
+		}
+		return moved;
+	}
+
+	bool collides() const
+	{
+		return (grid ? intersected(path, *grid) : intersected(path, *walls))
+			|| (arena && arena->hits(arena_id, body()));
+	}
+
+	// Upper bound on how far any point of the body moves in dt: the
+	// length of the arc its farthest corner takes around the turning
+	// center
+	double max_travel(double dt) const
+	{
+		if(std::fabs(wheels_angle) < 0.0001) {
+			return std::fabs(speed * dt);
+		}
+		const auto beta = std::fabs(speed * dt * std::tan(wheels_angle) / base);
+		const auto rc = rot_center();
+		auto r = 0.0;
+		for(const auto& s: path.paths[0].sects) {
+			r = std::max(r, (s.p0 - rc).norm());
+		}
+		return beta * r;
+	}
+
+	// Distances from the car body to the walls along the rays, at most
+	// their ranges
+	void sense()
+	{
+		constexpr auto limited = RayDirs<Layout, NRAYS>::limited;
+		if(grid && limited) {
+			ray_dists(rays, *grid, dists, limits);
+		} else if(grid) {
+			ray_dists(rays, *grid, dists);
+		} else {
+			ray_dists(rays, *walls, dists);
+		}
+		if(arena) {
+			arena->cast(arena_id, rays, arena_range, dists);
+		}
+		for(auto i = 0; i < NRAYS; i++) {
+			dists[i] = (limited ? std::min(dists[i], limits[i]) : dists[i])
+				- self_dists[i];
 		}
 	}
 
@@ -151,17 +289,23 @@ struct Car
 	{
 		const auto tn = std::tan(wheels_angle);
 		const auto beta = -speed * dt * tn / base;
-		const auto pg = wheels_angle > 0 ?
-					course.rperp() : course.lperp();
-		const auto rot_center = center - 0.5 * base * course
-			+ base / std::fabs(tn) * pg;
+		const auto rc = rot_center();
 		const auto s = std::sin(beta);
 		const auto c = std::cos(beta);
 		const auto m = Mtx2(Pt(c, -s),
 							Pt(s,  c));
-		center = rot_center + m * (center - rot_center);
+		center = rc + m * (center - rc);
 		course = m * course;
 	}
+
+	// Point the car turns around with the wheels turned
+	Pt rot_center() const
+	{
+		const auto pg = wheels_angle > 0 ?
+					course.rperp() : course.lperp();
+		return center - 0.5 * base * course
+			+ base / std::fabs(std::tan(wheels_angle)) * pg;
+	}
 };
 
 #endif
\ No newline at end of file
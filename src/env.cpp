@@ -0,0 +1,144 @@
+// libpolygonenv: the C interface of env.h over a VecEnv
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "env.h"
+#include "trackpool.h"
+#include "vecenv.h"
+
+constexpr std::size_t ENV_NRAYS = 36;
+constexpr std::size_t ENV_NA = 2;
+
+struct PolygonEnv
+{
+	template <typename... Args>
+	explicit PolygonEnv(Args&&... args)
+		: env(std::forward<Args>(args)...)
+	{}
+
+	VecEnv<ENV_NRAYS, ENV_NA> env;
+};
+
+static thread_local std::string last_error;
+
+// Runs f and turns exceptions into -1 and a message, as C callers can't
+// catch them
+template <typename F>
+static int guarded(F&& f)
+{
+	try {
+		f();
+		return 0;
+	} catch(const std::exception& e) {
+		last_error = e.what();
+	} catch(...) {
+		last_error = "unknown error";
+	}
+	return -1;
+}
+
+static PolygonEnv& checked(PolygonEnv* env, const char* fn)
+{
+	if(!env) {
+		throw std::runtime_error(std::string(fn) + ": null env");
+	}
+	return *env;
+}
+
+extern "C" {
+
+PolygonEnv* polygon_env_create(const PolygonEnvConfig* config)
+{
+	PolygonEnv* res = nullptr;
+	guarded([&]() {
+		if(!config || config->nworlds == 0) {
+			throw std::runtime_error("polygon_env_create: no worlds");
+		}
+		auto tracks = std::make_shared<TrackPool>();
+		for(auto i = 0; config->tracks && i < config->ntracks; i++) {
+			tracks->load(config->tracks[i]);
+		}
+		if(tracks->empty()) {
+			tracks->add(Track::clover());
+		}
+		EpisodeLimits limits;
+		limits.max_steps = config->max_steps > 0 ? config->max_steps : 1000;
+		if(config->stuck_steps != 0) {
+			limits.stuck_steps = std::max(config->stuck_steps, 0);
+		}
+		if(config->wrong_way != 0) {
+			limits.wrong_way = std::max(config->wrong_way, 0.0);
+		}
+		res = new PolygonEnv(tracks, config->nworlds, limits,
+			config->dt > 0 ? config->dt : 0.1,
+			config->nthreads > 0 ? config->nthreads : 1,
+			config->seed, config->fixed_starts != 0, config->pin_threads != 0);
+	});
+	return res;
+}
+
+void polygon_env_destroy(PolygonEnv* env)
+{
+	delete env;
+}
+
+unsigned polygon_env_num_worlds(const PolygonEnv* env)
+{
+	return env ? env->env.size() : 0;
+}
+
+unsigned polygon_env_obs_size(void)
+{
+	return ENV_NRAYS;
+}
+
+unsigned polygon_env_action_size(void)
+{
+	return ENV_NA;
+}
+
+int polygon_env_bind(PolygonEnv* env, double* obs, double* rewards,
+	unsigned char* dones)
+{
+	return guarded([&]() {
+		checked(env, "polygon_env_bind").env.bind(obs, rewards, dones);
+	});
+}
+
+int polygon_env_reset(PolygonEnv* env)
+{
+	return guarded([&]() { checked(env, "polygon_env_reset").env.reset(); });
+}
+
+int polygon_env_step(PolygonEnv* env, const double* actions)
+{
+	return guarded([&]() { checked(env, "polygon_env_step").env.step(actions); });
+}
+
+unsigned polygon_env_num_threads(const PolygonEnv* env)
+{
+	return env ? env->env.pool().size() : 0;
+}
+
+int polygon_env_usage(PolygonEnv* env, double* busy, double* wall)
+{
+	return guarded([&]() {
+		if(!busy || !wall) {
+			throw std::runtime_error("polygon_env_usage: null buffer");
+		}
+		const auto usage = checked(env, "polygon_env_usage").env.usage();
+		std::copy(usage.busy.cbegin(), usage.busy.cend(), busy);
+		*wall = usage.seconds;
+	});
+}
+
+const char* polygon_env_error(void)
+{
+	return last_error.c_str();
+}
+
+}
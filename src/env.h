@@ -0,0 +1,84 @@
+#ifndef __POLYGON_ENV_H
+#define __POLYGON_ENV_H
+
+/* C interface of libpolygonenv: a batch of Polygon worlds stepped with
+ * one call per tick, for training code in any language (numpy via
+ * ctypes or cffi, say).
+ *
+ * The caller owns every buffer. polygon_env_bind() hands over the
+ * observation, reward and done buffers once; reset and step write into
+ * them and never allocate. Buffers are laid out world after world:
+ *
+ *   obs      nworlds * polygon_env_obs_size() doubles, rays normalized
+ *            to [-1, 1]
+ *   rewards  nworlds doubles
+ *   dones    nworlds bytes, nonzero where an episode ended on this
+ *            step: POLYGON_ENV_STUCK, _WRONG_WAY or _STEP_LIMIT
+ *   actions  nworlds * polygon_env_action_size() doubles (speed,
+ *            wheels angle as a fraction of 45 degrees)
+ *
+ * A world that is done has already started its next episode, at a
+ * random spot of the track unless fixed_starts: its observation is the
+ * first one of that episode.
+ *
+ * Functions that can fail return 0 on success and -1 on failure;
+ * polygon_env_error() then describes the failure of the calling thread's
+ * last call. A handle may be used from one thread at a time. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PolygonEnv PolygonEnv;
+
+enum
+{
+	POLYGON_ENV_STUCK = 1,      /* pushed against a wall for stuck_steps */
+	POLYGON_ENV_WRONG_WAY = 2,  /* driven wrong_way back along the track */
+	POLYGON_ENV_STEP_LIMIT = 3
+};
+
+typedef struct PolygonEnvConfig
+{
+	unsigned nworlds;
+	const char* const* tracks; /* track files, or NULL for the built-in one */
+	unsigned ntracks;
+	unsigned max_steps;        /* per episode, 0 for the default of 1000 */
+	int stuck_steps;           /* 0 for 30, < 0 never */
+	double wrong_way;          /* track units, 0 for 15, < 0 never */
+	double dt;                 /* simulated seconds per step, 0 for 0.1 */
+	unsigned nthreads;         /* to step the worlds with, 0 for 1 */
+	unsigned seed;             /* of the random starts */
+	int fixed_starts;          /* nonzero: always start at the start line */
+	int pin_threads;           /* nonzero: nthreads threads of their own, one
+	                              per CPU, worlds and tracks on their NUMA
+	                              node */
+} PolygonEnvConfig;
+
+PolygonEnv* polygon_env_create(const PolygonEnvConfig* config);
+void polygon_env_destroy(PolygonEnv* env);
+
+unsigned polygon_env_num_worlds(const PolygonEnv* env);
+unsigned polygon_env_obs_size(void);
+unsigned polygon_env_action_size(void);
+
+int polygon_env_bind(PolygonEnv* env, double* obs, double* rewards,
+	unsigned char* dones);
+int polygon_env_reset(PolygonEnv* env);
+int polygon_env_step(PolygonEnv* env, const double* actions);
+
+/* Threads stepping the worlds; each owns a fixed share of them */
+unsigned polygon_env_num_threads(const PolygonEnv* env);
+
+/* Seconds every thread spent stepping its worlds (busy, num_threads
+ * values) and wall seconds, since the last call or the start. busy /
+ * wall is a thread's utilization, max / mean of busy the imbalance. */
+int polygon_env_usage(PolygonEnv* env, double* busy, double* wall);
+
+const char* polygon_env_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
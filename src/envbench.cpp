@@ -0,0 +1,245 @@
+// Steps a VecEnv with random actions and reports world steps per second
+// and how busy every thread was: its NUMA node, its share of the worlds,
+// utilization and the imbalance between threads. Then compares the cost
+// of sensing with a few sensor layouts (sensors.h), and forks lookahead
+// rollouts from one world (rollout.h).
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "car.h"
+#include "rollout.h"
+#include "sensors.h"
+#include "trackpool.h"
+#include "vecenv.h"
+
+constexpr std::size_t NRAYS = 36;
+constexpr std::size_t NA = 2;
+
+// Time of Car::sense() and of placing the rays, at poses all along the
+// way of track
+template <std::size_t N, typename Layout>
+void measure_layout(const char* name, const Track& track, unsigned nposes)
+{
+	Car<N, Layout> car(track.way->start_center(), track.way->start_course(),
+		track.walls);
+	car.grid = track.grid;
+	std::vector<Pt> centers(nposes), courses(nposes);
+	for(auto i = 0; i < nposes; i++) {
+		track.way->pose_at(track.way->length() * i / nposes, centers[i], courses[i]);
+	}
+	auto front = 360.0;
+	const auto& table = RayDirs<Layout, N>::table;
+	for(auto i = 0; i < N; i++) {
+		for(auto j = 0; j < N; j++) {
+			const auto a = std::atan2(table[i].s, table[i].c) * 180 / M_PI;
+			const auto b = std::atan2(table[j].s, table[j].c) * 180 / M_PI;
+			if(i != j && std::fabs(a) <= 45 && std::fabs(b) <= 45) {
+				front = std::min(front, std::fabs(a - b));
+			}
+		}
+	}
+
+	// best of a few rounds, so that layouts measured first don't pay for
+	// warming up
+	auto sink = 0.0;
+	auto ns = 1.0e20;
+	for(auto round = 0; round < 5; round++) {
+		const auto t0 = std::chrono::steady_clock::now();
+		for(auto i = 0; i < nposes; i++) {
+			car.center = centers[i];
+			car.course = courses[i];
+			car.recalc_rays();
+			car.sense();
+			sink += car.dists[0];
+		}
+		ns = std::min(ns, 1e9 * std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - t0).count() / nposes);
+	}
+	std::cout << std::setw(24) << std::left << name << std::right
+			  << std::setw(6) << N
+			  << std::fixed << std::setprecision(1) << std::setw(10) << front
+			  << std::setprecision(0) << std::setw(10) << ns
+			  << std::setw(10) << ns / N << "\n";
+	if(sink != sink) {
+		std::cout << "  (NaN distance)\n";
+	}
+}
+
+// Rollouts per second forked from the state of world, and a check that
+// a rollout drives just like the world itself given the same actions
+void measure_rollouts(World<NRAYS, NA>& world, unsigned threads,
+	std::size_t nrollouts, unsigned horizon)
+{
+	std::mt19937 gen(2);
+	std::uniform_real_distribution<Float> u(-1.0, 1.0);
+	std::vector<std::array<Float, NA>> actions(nrollouts);
+	for(auto& a: actions) {
+		a[0] = 0.5 + 0.5 * u(gen);
+		a[1] = u(gen);
+	}
+	const auto policy = [&](std::size_t r, unsigned, const Float*, std::array<Float, NA>& a) {
+		a = actions[r];
+	};
+
+	Rollouts<NRAYS, NA> rollouts(threads, 0.1, 1.0, world.limits);
+	const auto from = world.save();
+	std::vector<double> returns(nrollouts);
+	rollouts.run(world.track, from, nrollouts, horizon, policy, returns.data());
+
+	const auto repeats = 20;
+	const auto t0 = std::chrono::steady_clock::now();
+	for(auto i = 0; i < repeats; i++) {
+		rollouts.run(world.track, from, nrollouts, horizon, policy, returns.data());
+	}
+	const auto seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - t0).count();
+
+	// the world goes on with the actions of rollout 0
+	auto ret = 0.0;
+	for(auto s = 0; s < horizon && !world.done(); s++) {
+		world.act(actions[0]);
+		ret += world.reward();
+	}
+	world.load(from);
+
+	std::cout << "\n" << nrollouts << " rollouts of " << horizon << " steps on "
+			  << threads << " threads: " << std::fixed << std::setprecision(0)
+			  << repeats * nrollouts / seconds << " rollouts/s, "
+			  << repeats * nrollouts * horizon / seconds << " steps/s\n"
+			  << "rollout 0 " << (ret == returns[0] ? "matches" : "differs from")
+			  << " the world driving on (return " << std::setprecision(3)
+			  << returns[0] << ")\n";
+}
+
+void usage()
+{
+	std::cerr << "usage: envbench [--worlds N] [--steps N] [--threads N] [--pin]\n"
+			  << "                [--rollouts N] [--horizon N] [TRACK...]\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t nworlds = 4096;
+	unsigned steps = 200;
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	auto pin = false;
+	std::size_t nrollouts = 256;
+	unsigned horizon = 20;
+	auto tracks = std::make_shared<TrackPool>();
+
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto has_value = i + 1 < argc;
+		if(arg == "--worlds" && has_value) {
+			nworlds = std::atoi(argv[++i]);
+		} else if(arg == "--steps" && has_value) {
+			steps = std::atoi(argv[++i]);
+		} else if(arg == "--threads" && has_value) {
+			threads = std::atoi(argv[++i]);
+		} else if(arg == "--rollouts" && has_value) {
+			nrollouts = std::atoi(argv[++i]);
+		} else if(arg == "--horizon" && has_value) {
+			horizon = std::atoi(argv[++i]);
+		} else if(arg == "--pin") {
+			pin = true;
+		} else if(!arg.empty() && arg[0] != '-') {
+			tracks->load(arg);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if(nworlds == 0 || steps == 0 || threads == 0 || nrollouts == 0 || horizon == 0) {
+		usage();
+		return 1;
+	}
+
+	try {
+		if(tracks->empty()) {
+			tracks->add(Track::clover());
+		}
+		VecEnv<NRAYS, NA> env(tracks, nworlds, EpisodeLimits(), 0.1, threads,
+			1, false, pin);
+		std::vector<Float> obs(nworlds * NRAYS), rewards(nworlds);
+		std::vector<std::uint8_t> dones(nworlds);
+		env.bind(obs.data(), rewards.data(), dones.data());
+		env.reset();
+
+		// a few sets of actions, drawn up front
+		std::mt19937 gen(1);
+		std::uniform_real_distribution<Float> u(-1.0, 1.0);
+		std::vector<std::vector<Float>> actions(8, std::vector<Float>(nworlds * NA));
+		for(auto& a: actions) {
+			for(auto i = 0; i < nworlds; i++) {
+				a[i * NA] = 0.5 + 0.5 * u(gen);
+				a[i * NA + 1] = u(gen);
+			}
+		}
+
+		env.usage();
+		const auto t0 = std::chrono::steady_clock::now();
+		for(auto s = 0; s < steps; s++) {
+			env.step(actions[s % actions.size()].data());
+		}
+		const auto seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - t0).count();
+		const auto report = env.usage();
+
+		std::cout << nworlds << " worlds, " << steps << " steps on "
+				  << threads << (pin ? " pinned" : "") << " threads, "
+				  << env.pool().num_nodes() << " NUMA node(s): "
+				  << std::fixed << std::setprecision(0)
+				  << nworlds * steps / seconds << " world steps/s\n"
+				  << std::setw(8) << "thread"
+				  << std::setw(6) << "node"
+				  << std::setw(9) << "worlds"
+				  << std::setw(10) << "busy s"
+				  << std::setw(8) << "util" << "\n";
+		for(auto t = 0; t < report.busy.size(); t++) {
+			std::cout << std::setw(8) << t
+					  << std::setw(6) << env.pool().node(t)
+					  << std::setw(9) << nworlds * (t + 1) / threads - nworlds * t / threads
+					  << std::setprecision(3) << std::setw(10) << report.busy[t]
+					  << std::setprecision(0) << std::setw(7)
+					  << 100 * report.utilization(t) << "%\n";
+		}
+		std::cout << "imbalance (busiest / mean) " << std::setprecision(3)
+				  << report.imbalance() << "\n";
+
+		std::cout << "\nsensing on " << (*tracks)[0]->name << "\n"
+				  << std::setw(24) << std::left << "layout" << std::right
+				  << std::setw(6) << "rays"
+				  << std::setw(10) << "front deg"
+				  << std::setw(10) << "ns"
+				  << std::setw(10) << "ns/ray" << "\n";
+		const auto& track = *(*tracks)[0];
+		const auto nposes = 20000;
+		measure_layout<36, UniformRays>("uniform", track, nposes);
+		measure_layout<20, ForwardRays<90>>("forward 90", track, nposes);
+		measure_layout<20, ForwardRays<90, 5>>("forward 90, rear 5", track, nposes);
+		measure_layout<20, ForwardRays<90, 5, 20>>("forward 90 +20, rear 5", track, nposes);
+		measure_layout<9, AngleRays<-90, -45, -20, -10, 0, 10, 20, 45, 90>>(
+			"angles -90..90", track, nposes);
+		measure_layout<12, AngleRays<-90, -45, -20, -10, 0, 10, 20, 45, 90, 135, 180, 225>
+			::Ranges<0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 3, 3>>(
+			"angles -90..90, rear 3", track, nposes);
+		measure_layout<12, AngleRays<-90, -45, -20, -10, 0, 10, 20, 45, 90, 135, 180, 225>>(
+			"angles -90..90, rear", track, nposes);
+
+		World<NRAYS, NA> world((*tracks)[0]);
+		for(auto s = 0; s < 30; s++) {
+			world.act(std::array<Float, NA>{{0.8, 0.2}});
+		}
+		measure_rollouts(world, threads, nrollouts, horizon);
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+}
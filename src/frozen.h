@@ -0,0 +1,430 @@
+#ifndef __POLYGON_FROZEN_H
+#define __POLYGON_FROZEN_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__AVX2__) || (defined(__GNUC__) && defined(__x86_64__))
+#define __POLYGON_FROZEN_AVX2
+#endif
+
+#include "mlp.h"
+
+// Inference-only copy of a tanh MLP (e.g. the actor of a trained Cacla),
+// without tiny-dnn, training state or doubles.
+//
+// All weights live in one contiguous array, input-major: the weights of
+// input c to all outputs of a layer are adjacent, padded with zeros to a
+// multiple of 8 outputs. A layer is then a sum of x[c] * column c, which
+// keeps every output lane of the SIMD registers busy and has no
+// horizontal sums. In int8 mode every output row is quantized
+// symmetrically with its own scale and the input of every layer with one
+// scale per call; columns are interleaved in pairs so that one madd
+// handles two inputs at once, accumulating in int32: AVX2 when the CPU
+// has it (checked at run time unless compiled with native=1), SSE2
+// otherwise. Hidden layers use a rational tanh.
+//
+// call() keeps its activations on the stack, so it is reentrant.
+
+enum class FrozenMode : std::uint32_t { float32 = 0, int8 = 1 };
+
+constexpr std::size_t FROZEN_MAX_WIDTH = 256;
+
+inline std::size_t frozen_pad(std::size_t n, std::size_t k)
+{
+	return (n + k - 1) / k * k;
+}
+
+// Lambert's continued fraction; max error ~1e-5 on [-4.97, 4.97]
+inline float fast_tanh(float x)
+{
+	x = std::min(std::max(x, -4.97f), 4.97f);
+	const auto x2 = x * x;
+	const auto p = x * (135135.0f + x2 * (17325.0f + x2 * (378.0f + x2)));
+	const auto q = 135135.0f + x2 * (62370.0f + x2 * (3150.0f + x2 * 28.0f));
+	return p / q;
+}
+
+// Quantizes x[0..n) to [-127, 127] with one scale, which it returns,
+// rounding halves away from 0. Without branches on the sign, which
+// mispredict on activations.
+inline float frozen_quantize(const float* x, std::size_t n, std::int16_t* q)
+{
+	auto m = 0.0f;
+	std::size_t c = 0;
+#if defined(__SSE2__)
+	// 4 running maxima; one would wait on the previous max every time
+	const auto abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	auto mv = _mm_setzero_ps();
+	for(; c + 4 <= n; c += 4) {
+		mv = _mm_max_ps(mv, _mm_and_ps(_mm_loadu_ps(x + c), abs_mask));
+	}
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, mv);
+	m = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+	for(; c < n; c++) {
+		m = std::max(m, std::fabs(x[c]));
+	}
+	const auto xs = (m > 0) ? m / 127.0f : 1.0f;
+	const auto inv = 1.0f / xs;
+	for(c = 0; c < n; c++) {
+		q[c] = static_cast<std::int16_t>(x[c] * inv + std::copysign(0.5f, x[c]));
+	}
+	return xs;
+}
+
+// y[0..os) = b + sum_c x[c] * w[c*os..(c+1)*os); os is a multiple of 8
+inline void frozen_layer_f32(const float* w, const float* b,
+	const float* x, std::size_t ni, std::size_t os, float* __restrict y)
+{
+	std::copy(b, b + os, y);
+	for(std::size_t c = 0; c < ni; c++) {
+		const auto xc = x[c];
+		const auto* wc = w + c * os;
+		for(std::size_t i = 0; i < os; i++) {
+			y[i] += xc * wc[i];
+		}
+	}
+}
+
+#if defined(__POLYGON_FROZEN_AVX2)
+// frozen_layer_i8() with AVX2, built for it even when the rest of the
+// program isn't; only called on CPUs that have it
+__attribute__((target("avx2")))
+inline void frozen_layer_i8_avx2(const std::int8_t* w, const std::int16_t* x,
+	std::size_t np, std::size_t os, std::int32_t* acc)
+{
+	for(std::size_t g = 0; g < os; g += 8) {
+		auto a = _mm256_setzero_si256();
+		for(std::size_t j = 0; j < np; j++) {
+			std::int32_t xp;
+			std::memcpy(&xp, x + 2 * j, sizeof(xp));
+			const auto wv = _mm256_cvtepi8_epi16(_mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(w + (j * os + g) * 2)));
+			a = _mm256_add_epi32(a, _mm256_madd_epi16(wv, _mm256_set1_epi32(xp)));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + g), a);
+	}
+}
+#endif
+
+// Whether frozen_layer_i8() runs the AVX2 kernel
+inline bool frozen_i8_avx2()
+{
+#if defined(__AVX2__)
+	return true;
+#elif defined(__POLYGON_FROZEN_AVX2)
+	static const bool has = __builtin_cpu_supports("avx2");
+	return has;
+#else
+	return false;
+#endif
+}
+
+// acc[0..os) = sum_j x[2j] * w(2j) + x[2j+1] * w(2j+1), with the columns
+// of each input pair interleaved: w[(j*os + i)*2 + {0, 1}].
+// np is the number of pairs, os a multiple of 8.
+inline void frozen_layer_i8(const std::int8_t* w, const std::int16_t* x,
+	std::size_t np, std::size_t os, std::int32_t* acc)
+{
+#if defined(__POLYGON_FROZEN_AVX2)
+	if(frozen_i8_avx2()) {
+		frozen_layer_i8_avx2(w, x, np, os, acc);
+		return;
+	}
+#endif
+#if defined(__SSE2__)
+	for(std::size_t g = 0; g < os; g += 4) {
+		auto a = _mm_setzero_si128();
+		for(std::size_t j = 0; j < np; j++) {
+			std::int32_t xp;
+			std::memcpy(&xp, x + 2 * j, sizeof(xp));
+			auto wv = _mm_loadl_epi64(
+				reinterpret_cast<const __m128i*>(w + (j * os + g) * 2));
+			// sign-extend the 8 bytes to 8 int16
+			wv = _mm_srai_epi16(_mm_unpacklo_epi8(wv, wv), 8);
+			a = _mm_add_epi32(a, _mm_madd_epi16(wv, _mm_set1_epi32(xp)));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + g), a);
+	}
+#else
+	std::fill(acc, acc + os, 0);
+	for(std::size_t j = 0; j < np; j++) {
+		const auto* wj = w + j * os * 2;
+		for(std::size_t i = 0; i < os; i++) {
+			acc[i] += std::int32_t(wj[2*i]) * x[2*j]
+				+ std::int32_t(wj[2*i + 1]) * x[2*j + 1];
+		}
+	}
+#endif
+}
+
+class FrozenPolicy
+{
+public:
+	FrozenPolicy() {}
+
+	static FrozenPolicy freeze(const MLPWeights& weights, FrozenMode mode)
+	{
+		if(weights.max_width() > FROZEN_MAX_WIDTH) {
+			throw std::runtime_error("layer too wide to freeze");
+		}
+		FrozenPolicy p;
+		p.mode = mode;
+		p.sizes.assign(weights.sizes.cbegin(), weights.sizes.cend());
+		p.layout();
+		for(auto l = 0; l < p.layers.size(); l++) {
+			const auto& L = p.layers[l];
+			for(auto i = 0; i < L.no; i++) {
+				const auto* row = weights.w[l].data() + i * L.ni;
+				p.fdata[L.b_off + i] = weights.b[l][i];
+				if(mode == FrozenMode::float32) {
+					for(auto c = 0; c < L.ni; c++) {
+						p.fdata[L.w_off + c * L.os + i] = row[c];
+					}
+				} else {
+					auto m = 0.0;
+					for(auto c = 0; c < L.ni; c++) {
+						m = std::max(m, std::fabs(row[c]));
+					}
+					const auto scale = (m > 0) ? m / 127.0 : 1.0;
+					p.fdata[L.s_off + i] = scale;
+					for(auto c = 0; c < L.ni; c++) {
+						p.qdata[L.w_off + ((c / 2) * L.os + i) * 2 + c % 2] =
+							static_cast<std::int8_t>(std::lround(row[c] / scale));
+					}
+				}
+			}
+		}
+		return p;
+	}
+
+	std::size_t n_in() const
+	{
+		return sizes.front();
+	}
+
+	std::size_t n_out() const
+	{
+		return sizes.back();
+	}
+
+	FrozenMode get_mode() const
+	{
+		return mode;
+	}
+
+	template <typename X, typename R>
+	void call(const X& x, R& res) const
+	{
+		alignas(32) float buf[2][FROZEN_MAX_WIDTH];
+		alignas(32) std::int16_t qbuf[FROZEN_MAX_WIDTH];
+		alignas(32) std::int32_t acc[FROZEN_MAX_WIDTH];
+		auto* cur = buf[0];
+		auto* nxt = buf[1];
+		const auto ni = n_in();
+		std::copy(std::begin(x), std::begin(x) + ni, cur);
+
+		for(auto l = 0; l < layers.size(); l++) {
+			const auto& L = layers[l];
+			const float* b = fdata.data() + L.b_off;
+			if(mode == FrozenMode::float32) {
+				frozen_layer_f32(fdata.data() + L.w_off, b, cur, L.ni, L.os, nxt);
+			} else {
+				const auto xs = frozen_quantize(cur, L.ni, qbuf);
+				qbuf[L.ni] = 0;
+				frozen_layer_i8(qdata.data() + L.w_off, qbuf,
+					(L.ni + 1) / 2, L.os, acc);
+				const float* s = fdata.data() + L.s_off;
+				for(auto i = 0; i < L.os; i++) {
+					nxt[i] = acc[i] * (s[i] * xs) + b[i];
+				}
+			}
+			if(l + 1 == layers.size()) {
+				std::copy(nxt, nxt + L.no, std::begin(res));
+			} else {
+				for(auto i = 0; i < L.no; i++) {
+					nxt[i] = fast_tanh(nxt[i]);
+				}
+				std::swap(cur, nxt);
+			}
+		}
+	}
+
+	template <std::size_t NO, typename X>
+	std::array<Float, NO> call(const X& x) const
+	{
+		std::array<Float, NO> res;
+		call(x, res);
+		return res;
+	}
+
+	// File: magic, mode, number of sizes, sizes, then fdata and qdata
+	// as laid out in memory
+	void save(const std::string& path) const
+	{
+		std::ofstream ofs(path, std::ios::binary);
+		const std::uint32_t hdr[3] = {static_cast<std::uint32_t>(mode),
+			static_cast<std::uint32_t>(sizes.size()), 0};
+		ofs.write(FROZEN_MAGIC, sizeof(FROZEN_MAGIC));
+		ofs.write(reinterpret_cast<const char*>(hdr), sizeof(hdr));
+		ofs.write(reinterpret_cast<const char*>(sizes.data()),
+			sizeof(std::uint32_t) * sizes.size());
+		ofs.write(reinterpret_cast<const char*>(fdata.data()),
+			sizeof(float) * fdata.size());
+		ofs.write(reinterpret_cast<const char*>(qdata.data()), qdata.size());
+		if(!ofs) {
+			throw std::runtime_error("can't write frozen policy " + path);
+		}
+	}
+
+	static FrozenPolicy load(const std::string& path)
+	{
+		std::ifstream ifs(path, std::ios::binary);
+		char magic[sizeof(FROZEN_MAGIC)];
+		std::uint32_t hdr[3];
+		ifs.read(magic, sizeof(magic));
+		ifs.read(reinterpret_cast<char*>(hdr), sizeof(hdr));
+		if(!ifs || std::memcmp(magic, FROZEN_MAGIC, sizeof(magic)) != 0
+			|| hdr[0] > 1 || hdr[1] < 2 || hdr[1] > 64) {
+			throw std::runtime_error("bad frozen policy " + path);
+		}
+		FrozenPolicy p;
+		p.mode = static_cast<FrozenMode>(hdr[0]);
+		p.sizes.resize(hdr[1]);
+		ifs.read(reinterpret_cast<char*>(p.sizes.data()),
+			sizeof(std::uint32_t) * p.sizes.size());
+		for(auto s: p.sizes) {
+			if(s == 0 || s > FROZEN_MAX_WIDTH) {
+				throw std::runtime_error("bad frozen policy " + path);
+			}
+		}
+		p.layout();
+		ifs.read(reinterpret_cast<char*>(p.fdata.data()),
+			sizeof(float) * p.fdata.size());
+		ifs.read(reinterpret_cast<char*>(p.qdata.data()), p.qdata.size());
+		if(!ifs) {
+			throw std::runtime_error("bad frozen policy " + path);
+		}
+		return p;
+	}
+
+private:
+	static constexpr char FROZEN_MAGIC[8] = {'P', 'L', 'G', 'F', 'R', 'Z', 'N', '1'};
+
+	struct Layer
+	{
+		std::size_t ni, no, os;
+		std::size_t w_off;  // into fdata (float32) or qdata (int8)
+		std::size_t b_off;  // into fdata
+		std::size_t s_off;  // into fdata, int8 row scales
+	};
+
+	// Offsets of every layer for the current sizes and mode
+	void layout()
+	{
+		layers.clear();
+		std::size_t foff = 0, qoff = 0;
+		for(auto l = 0; l + 1 < sizes.size(); l++) {
+			Layer L;
+			L.ni = sizes[l];
+			L.no = sizes[l + 1];
+			L.os = frozen_pad(L.no, 8);
+			if(mode == FrozenMode::float32) {
+				L.w_off = foff;
+				foff += L.ni * L.os;
+				L.s_off = 0;
+			} else {
+				L.w_off = qoff;
+				qoff += frozen_pad(L.ni, 2) * L.os;
+				L.s_off = foff;
+				foff += L.os;
+			}
+			L.b_off = foff;
+			foff += L.os;
+			layers.emplace_back(L);
+		}
+		fdata.assign(foff, 0.0f);
+		qdata.assign(qoff, 0);
+	}
+
+	FrozenMode mode = FrozenMode::float32;
+	std::vector<std::uint32_t> sizes;
+	std::vector<Layer> layers;
+	std::vector<float> fdata;
+	std::vector<std::int8_t> qdata;
+};
+
+constexpr char FrozenPolicy::FROZEN_MAGIC[8];
+
+// Compares a frozen policy with the network it came from (anything with
+// call(x) returning NO outputs, e.g. ApproxTiny) on nsamples random
+// inputs in [-0.9, 0.9], and times both.
+template <std::size_t NI, std::size_t NO, typename A>
+void report_accuracy(std::ostream& os, const A& reference,
+	const FrozenPolicy& frozen, std::size_t nsamples = 10000,
+	unsigned seed = 1)
+{
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<Float> ud(-0.9, 0.9);
+	std::vector<std::array<Float, NI>> xs(nsamples);
+	for(auto& x: xs) {
+		for(auto& v: x) {
+			v = ud(gen);
+		}
+	}
+
+	std::vector<std::array<Float, NO>> ref(nsamples), out(nsamples);
+	const auto t0 = std::chrono::steady_clock::now();
+	for(auto i = 0; i < nsamples; i++) {
+		ref[i] = reference.call(xs[i]);
+	}
+	const auto t1 = std::chrono::steady_clock::now();
+	for(auto i = 0; i < nsamples; i++) {
+		frozen.call(xs[i], out[i]);
+	}
+	const auto t2 = std::chrono::steady_clock::now();
+
+	std::array<Float, NO> max_err, sum_err;
+	max_err.fill(0);
+	sum_err.fill(0);
+	for(auto i = 0; i < nsamples; i++) {
+		for(auto k = 0; k < NO; k++) {
+			const auto e = std::fabs(out[i][k] - ref[i][k]);
+			max_err[k] = std::max(max_err[k], e);
+			sum_err[k] += e;
+		}
+	}
+
+	const auto ns = [nsamples](std::chrono::steady_clock::duration d) {
+		return std::chrono::duration<double, std::nano>(d).count() / nsamples;
+	};
+	os << "frozen ";
+	if(frozen.get_mode() == FrozenMode::int8) {
+		os << "int8 (" << (frozen_i8_avx2() ? "avx2" : "sse2") << ")";
+	} else {
+		os << "float32";
+	}
+	os << " vs reference, " << nsamples << " samples\n";
+	for(auto k = 0; k < NO; k++) {
+		os << "  out[" << k << "]: max |err| " << max_err[k]
+		   << ", mean |err| " << sum_err[k] / nsamples << "\n";
+	}
+	os << "  reference: " << ns(t1 - t0) << " ns/call, frozen: "
+	   << ns(t2 - t1) << " ns/call\n";
+}
+
+#endif
@@ -1,12 +1,24 @@
 #ifndef __POLYGON_GEOM_H
 #define __POLYGON_GEOM_H
 
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <cmath>
+#include <ostream>
 
 typedef double Float;
 
+struct Range
+{
+	Float lo = 0;
+	Float hi = 0;
+
+	constexpr Range() {}
+	constexpr Range(Float alo, Float ahi)
+		:lo(alo), hi(ahi) {}
+};
+
 // Point
 
 struct Pt {
@@ -146,11 +158,54 @@ constexpr Isx intersect(const Sect& subj, const Sect& obj, bool is_ray)
 	return isx;
 }
 
+// Where a ray (p0 = origin, p1 = direction) meets obj, in lengths of
+// p1 along it, or -1 for a miss: intersect() for sensing, without the
+// hit point, the square root and most divisions
+constexpr Float ray_dist(const Sect& ray, const Sect& obj)
+{
+	const auto a2 = obj.p0 - obj.p1;
+	const auto b = obj.p0 - ray.p0;
+	const auto det = vdot(ray.p1, a2);
+	if(std::fabs(det) <= 1e-8) {
+		return -1;
+	}
+	// x0 = n0 / det along the ray, x1 = n1 / det along obj; misses are
+	// told by the signs alone, so only hits pay for the division
+	const auto n0 = vdot(b, a2);
+	const auto n1 = vdot(ray.p1, b);
+	const auto miss = det > 0
+		? n0 < 0.0 || n1 < 0.0 || n1 > det
+		: n0 > 0.0 || n1 > 0.0 || n1 < det;
+	return miss ? -1 : n0 / det;
+}
+
 std::ostream& operator<<(std::ostream& os, const Isx& isx)
 {
 	return os << "Isx[" << isx.point << "; " << isx.dist << "]";
 }
 
+// Distances
+
+// Squared distance from p to the closest point of s
+constexpr Float distance2(const Pt& p, const Sect& s)
+{
+	const auto d = s.p1 - s.p0;
+	const auto len2 = dot(d, d);
+	auto t = len2 > 0.0 ? dot(p - s.p0, d) / len2 : 0.0;
+	t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+	const auto e = p - (s.p0 + t * d);
+	return dot(e, e);
+}
+
+// Whether two sections come closer than dist (crossing ones always do)
+bool within(const Sect& a, const Sect& b, Float dist)
+{
+	const auto d2 = dist * dist;
+	return distance2(a.p0, b) < d2 || distance2(a.p1, b) < d2
+		|| distance2(b.p0, a) < d2 || distance2(b.p1, a) < d2
+		|| intersect(a, b, false).dist >= 0.0;
+}
+
 // Path
 
 struct Path
@@ -225,6 +280,23 @@ bool intersected(const Figure& subjs, const Figure& objs)
 	return false;
 }
 
+// Whether any sections of two figures come closer than dist
+bool within(const Figure& subjs, const Figure& objs, Float dist)
+{
+	for(const auto& p1: subjs.paths) {
+		for(const auto& s: p1.sects) {
+			for(const auto& p2: objs.paths) {
+				for(const auto& o: p2.sects) {
+					if(within(s, o, dist)) {
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
 template <typename Rays, typename Isxs>
 void intersect(const Rays& rays,
 	const Figure& figure,
@@ -251,20 +323,24 @@ void intersect(const Rays& rays,
 	}
 }
 
-template <typename T>
-void recalc_rays_a(T& rays,
-	const Pt& center, const Pt& course)
+// Distance along every ray to the nearest section of figure, 1.0e20 for
+// a miss, like intersect() over a Figure
+template <typename Rays, typename Dists>
+void ray_dists(const Rays& rays, const Figure& figure, Dists& dists)
 {
-	auto k = 2.0 * M_PI / rays.size();
 	auto i = 0;
-	for(auto& r: rays) {
-		auto angle = k * i;
-		auto s = std::sin(angle);
-		auto c = std::cos(angle);
-		r = Sect(center, Pt(c*course.x - s*course.y,
-							s*course.x + c*course.y));
-		i++;
+	for(const auto& r: rays) {
+		auto best = 1.0e20;
+		for(const auto& p: figure.paths) {
+			for(const auto& s: p.sects) {
+				const auto t = ray_dist(r, s);
+				if(t >= 0.0 && t < best) {
+					best = t;
+				}
+			}
+		}
+		dists[i++] = best < 1.0e20 ? best * r.p1.norm() : best;
 	}
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,345 @@
+#ifndef __POLYGON_GRID_H
+#define __POLYGON_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "geom.h"
+
+// Uniform grid over the sections of a figure.
+//
+// Cell (ix, iy) owns items[cell_start[iy*nx + ix] .. cell_start[iy*nx + ix + 1]),
+// indices into sects of every section whose bounding box touches the cell.
+// The arrays are plain pointers so that a grid can live either in its own
+// vectors (build) or directly in a memory-mapped track file; storage keeps
+// whichever of them alive.
+struct SectGrid
+{
+	Pt origin;
+	Float cell = 1.0;
+	std::uint32_t nx = 0;
+	std::uint32_t ny = 0;
+
+	const Sect* sects = nullptr;
+	std::uint64_t nsects = 0;
+	const std::uint32_t* cell_start = nullptr;
+	const std::uint32_t* items = nullptr;
+	std::uint64_t nitems = 0;
+
+	std::shared_ptr<const void> storage;
+
+	static SectGrid build(const Figure& figure, Float acell = 0.0)
+	{
+		auto owned = std::make_shared<Owned>();
+		for(const auto& p: figure.paths) {
+			owned->sects.insert(owned->sects.end(),
+				p.sects.cbegin(), p.sects.cend());
+		}
+
+		SectGrid g;
+		if(owned->sects.empty()) {
+			owned->cell_start.assign(1, 0);
+			g.attach(owned);
+			return g;
+		}
+
+		Pt lo(1.0e20, 1.0e20), hi(-1.0e20, -1.0e20);
+		auto total_len = 0.0;
+		for(const auto& s: owned->sects) {
+			lo = Pt(std::min({lo.x, s.p0.x, s.p1.x}),
+					std::min({lo.y, s.p0.y, s.p1.y}));
+			hi = Pt(std::max({hi.x, s.p0.x, s.p1.x}),
+					std::max({hi.y, s.p0.y, s.p1.y}));
+			total_len += (s.p1 - s.p0).norm();
+		}
+		const auto n = owned->sects.size();
+		const auto size = hi - lo;
+		if(acell <= 0.0) {
+			// about two sections per cell along the walls, but never
+			// more cells than a few per section for sparse layouts
+			acell = std::max(2.0 * total_len / n,
+				std::sqrt(size.x * size.y / (4.0 * n)));
+		}
+		g.origin = lo;
+		g.cell = std::max(acell, 1.0e-6);
+		g.nx = static_cast<std::uint32_t>(size.x / g.cell) + 1;
+		g.ny = static_cast<std::uint32_t>(size.y / g.cell) + 1;
+
+		// counting pass, then fill pass (CSR layout)
+		auto& start = owned->cell_start;
+		start.assign(std::size_t(g.nx) * g.ny + 1, 0);
+		for(const auto& s: owned->sects) {
+			g.for_cells(s, [&start](std::size_t c) { start[c + 1]++; });
+		}
+		for(auto c = 1; c < start.size(); c++) {
+			start[c] += start[c - 1];
+		}
+		owned->items.resize(start.back());
+		auto fill = std::vector<std::uint32_t>(start.cbegin(), start.cend() - 1);
+		for(std::uint32_t i = 0; i < n; i++) {
+			g.for_cells(owned->sects[i], [&](std::size_t c) {
+				owned->items[fill[c]++] = i;
+			});
+		}
+
+		g.attach(owned);
+		return g;
+	}
+
+	// Calls f(cell index) for every cell the bounding box of s touches
+	template <typename F>
+	void for_cells(const Sect& s, F&& f) const
+	{
+		const auto x0 = cell_x(std::min(s.p0.x, s.p1.x));
+		const auto x1 = cell_x(std::max(s.p0.x, s.p1.x));
+		const auto y0 = cell_y(std::min(s.p0.y, s.p1.y));
+		const auto y1 = cell_y(std::max(s.p0.y, s.p1.y));
+		for(auto iy = y0; iy <= y1; iy++) {
+			for(auto ix = x0; ix <= x1; ix++) {
+				f(std::size_t(iy) * nx + ix);
+			}
+		}
+	}
+
+	std::uint32_t cell_x(Float x) const
+	{
+		return clamp_cell((x - origin.x) / cell, nx);
+	}
+
+	std::uint32_t cell_y(Float y) const
+	{
+		return clamp_cell((y - origin.y) / cell, ny);
+	}
+
+	Pt hi() const
+	{
+		return origin + Pt(nx * cell, ny * cell);
+	}
+
+private:
+	struct Owned
+	{
+		std::vector<Sect> sects;
+		std::vector<std::uint32_t> cell_start;
+		std::vector<std::uint32_t> items;
+	};
+
+	void attach(const std::shared_ptr<Owned>& owned)
+	{
+		sects = owned->sects.data();
+		nsects = owned->sects.size();
+		cell_start = owned->cell_start.data();
+		items = owned->items.data();
+		nitems = owned->items.size();
+		storage = owned;
+	}
+
+	static std::uint32_t clamp_cell(Float v, std::uint32_t n)
+	{
+		if(!(v > 0.0)) {
+			return 0;
+		}
+		if(v >= n) {
+			return n - 1;
+		}
+		return static_cast<std::uint32_t>(v);
+	}
+};
+
+// Nearest hit of a ray (p0 = origin, p1 = direction, as built by
+// place_rays) with the sections of the grid, in lengths of p1 along
+// the ray (see ray_dist). Walks the cells along the ray (Amanatides-Woo)
+// and stops as soon as the best hit is closer than the far side of the
+// current cell, or the walk gets past max_t. Returns 1.0e20 for a miss;
+// hits past max_t may or may not be found.
+Float cast_dist(const Sect& ray, const SectGrid& g, Float max_t = 1.0e20)
+{
+	auto best = 1.0e20;
+	if(g.nsects == 0) {
+		return best;
+	}
+
+	const auto& o = ray.p0;
+	const auto& d = ray.p1;
+	const auto inf = std::numeric_limits<Float>::infinity();
+	const auto hi = g.hi();
+
+	// clip the ray to the grid box
+	auto t0 = 0.0, t1 = inf;
+	const Float os[2] = {o.x, o.y};
+	const Float ds[2] = {d.x, d.y};
+	const Float los[2] = {g.origin.x, g.origin.y};
+	const Float his[2] = {hi.x, hi.y};
+	for(auto k = 0; k < 2; k++) {
+		if(std::fabs(ds[k]) < 1e-12) {
+			if(os[k] < los[k] || os[k] > his[k]) {
+				return best;
+			}
+		} else {
+			auto ta = (los[k] - os[k]) / ds[k];
+			auto tb = (his[k] - os[k]) / ds[k];
+			if(ta > tb) {
+				std::swap(ta, tb);
+			}
+			t0 = std::max(t0, ta);
+			t1 = std::min(t1, tb);
+		}
+	}
+	// nothing to walk when the box starts past max_t
+	t1 = std::min<Float>(t1, max_t);
+	if(t0 > t1) {
+		return best;
+	}
+
+	const auto entry = o + t0 * d;
+	std::int64_t ix = g.cell_x(entry.x);
+	std::int64_t iy = g.cell_y(entry.y);
+	const int step_x = d.x > 0 ? 1 : -1;
+	const int step_y = d.y > 0 ? 1 : -1;
+	auto next_x = std::fabs(d.x) < 1e-12 ? inf
+		: (g.origin.x + (ix + (d.x > 0 ? 1 : 0)) * g.cell - o.x) / d.x;
+	auto next_y = std::fabs(d.y) < 1e-12 ? inf
+		: (g.origin.y + (iy + (d.y > 0 ? 1 : 0)) * g.cell - o.y) / d.y;
+	const auto delta_x = std::fabs(d.x) < 1e-12 ? inf : g.cell / std::fabs(d.x);
+	const auto delta_y = std::fabs(d.y) < 1e-12 ? inf : g.cell / std::fabs(d.y);
+
+	for(;;) {
+		const auto c = std::size_t(iy) * g.nx + ix;
+		for(auto k = g.cell_start[c]; k < g.cell_start[c + 1]; k++) {
+			const auto t = ray_dist(ray, g.sects[g.items[k]]);
+			if(t >= 0.0 && t < best) {
+				best = t;
+			}
+		}
+		const auto t_exit = std::min(next_x, next_y);
+		if(best <= t_exit || t_exit > t1) {
+			break;
+		}
+		if(next_x < next_y) {
+			ix += step_x;
+			next_x += delta_x;
+			if(ix < 0 || ix >= g.nx) {
+				break;
+			}
+		} else {
+			iy += step_y;
+			next_y += delta_y;
+			if(iy < 0 || iy >= g.ny) {
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+// cast_dist() with the hit point and the distance in length units.
+// Returns dist 1.0e20 for a miss, like the brute-force intersect() over
+// a Figure.
+Isx cast(const Sect& ray, const SectGrid& g)
+{
+	const auto t = cast_dist(ray, g);
+	if(t >= 1.0e20) {
+		return Isx(Pt(), t);
+	}
+	return Isx(ray.p0 + t * ray.p1, t * ray.p1.norm());
+}
+
+// Distance along every ray to the nearest section of the grid, 1.0e20
+// for a miss
+template <typename Rays, typename Dists>
+void ray_dists(const Rays& rays, const SectGrid& grid, Dists& dists)
+{
+	auto i = 0;
+	for(const auto& r: rays) {
+		const auto t = cast_dist(r, grid);
+		dists[i++] = t < 1.0e20 ? t * r.p1.norm() : t;
+	}
+}
+
+// ray_dists() giving up on ray i past limits[i] length units
+template <typename Rays, typename Dists, typename Limits>
+void ray_dists(const Rays& rays, const SectGrid& grid, Dists& dists,
+	const Limits& limits)
+{
+	auto i = 0;
+	for(const auto& r: rays) {
+		const auto len = r.p1.norm();
+		const auto t = cast_dist(r, grid, limits[i] / len);
+		dists[i++] = t < 1.0e20 ? t * len : t;
+	}
+}
+
+template <typename Rays, typename Isxs>
+void intersect(const Rays& rays,
+	const SectGrid& grid,
+	Float infinity,
+	Isxs& intersections)
+{
+	auto i = 0;
+	for(const auto& r: rays) {
+		auto min_isx = cast(r, grid);
+		if(min_isx.dist < 0.0) {
+			intersections[i].dist = infinity;
+		} else {
+			intersections[i] = std::move(min_isx);
+		}
+		i++;
+	}
+}
+
+bool intersected(const Figure& subjs, const SectGrid& grid)
+{
+	for(const auto& p: subjs.paths) {
+		for(const auto& s: p.sects) {
+			auto hit = false;
+			grid.for_cells(s, [&](std::size_t c) {
+				for(auto k = grid.cell_start[c];
+					!hit && k < grid.cell_start[c + 1]; k++) {
+					auto isx = intersect(s, grid.sects[grid.items[k]], false);
+					hit = isx.dist >= 0;
+				}
+			});
+			if(hit) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Like within() over a Figure, visiting only the cells within dist of
+// the subjects' bounding box
+bool within(const Figure& subjs, const SectGrid& grid, Float dist)
+{
+	if(grid.nsects == 0) {
+		return false;
+	}
+	Pt lo(1.0e20, 1.0e20), hi(-1.0e20, -1.0e20);
+	for(const auto& p: subjs.paths) {
+		for(const auto& s: p.sects) {
+			lo = Pt(std::min({lo.x, s.p0.x, s.p1.x}),
+					std::min({lo.y, s.p0.y, s.p1.y}));
+			hi = Pt(std::max({hi.x, s.p0.x, s.p1.x}),
+					std::max({hi.y, s.p0.y, s.p1.y}));
+		}
+	}
+	const auto margin = Pt(dist, dist);
+	auto res = false;
+	grid.for_cells(Sect(lo - margin, hi + margin), [&](std::size_t c) {
+		for(auto k = grid.cell_start[c]; !res && k < grid.cell_start[c + 1]; k++) {
+			const auto& o = grid.sects[grid.items[k]];
+			for(const auto& p: subjs.paths) {
+				for(const auto& s: p.sects) {
+					res = res || within(s, o, dist);
+				}
+			}
+		}
+	});
+	return res;
+}
+
+#endif
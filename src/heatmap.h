@@ -0,0 +1,253 @@
+#ifndef __POLYGON_HEATMAP_H
+#define __POLYGON_HEATMAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "geom.h"
+#include "grid.h"
+#include "car.h"
+#include "pipeline.h"
+#include "polygon.h"
+#include "trackpool.h"
+
+// V and the actor's mean action over a band of car poses along the way
+// of a track.
+//
+// The band is made of the cells (of a square grid) whose center is
+// within max_way_dist of the way, found segment by segment, so building
+// it costs in proportion to the band rather than to the whole track, and
+// only its cells are stored. Each gets a car pose at its center, facing
+// along the nearest segment. Its sensor readings are cast once at
+// construction (they don't depend on the networks) and kept normalized,
+// like Polygon feeds them to the learner. Cells where the car would
+// overlap a wall, or outside the walls' bounding box, are dropped.
+//
+// refresh() then evaluates the networks over the cells in batches split
+// across threads, a limited number of cells per call, so the viewer can
+// spread a pass over many frames. The weights come from the snapshots a
+// Polygon publishes (value_weights, policy_weights), read through a
+// WeightReader per thread, so the learner may go on updating meanwhile.
+// A new pass only starts once a newer snapshot was published; a pass
+// spread over frames takes each batch from the latest one.
+template <std::size_t NRAYS, std::size_t NA, typename Layout = UniformRays>
+class Heatmap
+{
+public:
+	Float cell;
+
+	Heatmap(std::shared_ptr<const Track> atrack, const MinMax<NRAYS>& minmax,
+		Float acell = 2.0, Float max_way_dist = 6.0,
+		unsigned anthreads = std::thread::hardware_concurrency())
+		: cell(acell), track(atrack), nthreads(std::max(anthreads, 1u))
+	{
+		// cells of the bounding box of the band, only to number them
+		const auto& way = *track->way;
+		auto lo = way.points[0], hi = way.points[0];
+		for(const auto& p: way.points) {
+			lo = Pt(std::min(lo.x, p.x), std::min(lo.y, p.y));
+			hi = Pt(std::max(hi.x, p.x), std::max(hi.y, p.y));
+		}
+		origin = lo - Pt(max_way_dist, max_way_dist);
+		nx = static_cast<std::size_t>((hi.x - lo.x + 2 * max_way_dist) / cell) + 1;
+		ny = static_cast<std::size_t>((hi.y - lo.y + 2 * max_way_dist) / cell) + 1;
+
+		// the cells near each segment, then the nearest segment of each
+		struct Near
+		{
+			std::size_t k;
+			double dist;
+			int segment;
+		};
+		std::vector<Near> near;
+		const auto walls_lo = track->grid->origin;
+		const auto walls_hi = track->grid->hi();
+		for(auto i = 0; i < way.count; i++) {
+			const auto& a = way.points[i];
+			const auto& b = way.points[(i + 1) % way.count];
+			const auto x0 = index(std::min(a.x, b.x) - max_way_dist - origin.x, nx);
+			const auto x1 = index(std::max(a.x, b.x) + max_way_dist - origin.x, nx);
+			const auto y0 = index(std::min(a.y, b.y) - max_way_dist - origin.y, ny);
+			const auto y1 = index(std::max(a.y, b.y) + max_way_dist - origin.y, ny);
+			for(auto iy = y0; iy <= y1; iy++) {
+				for(auto ix = x0; ix <= x1; ix++) {
+					const auto k = iy * nx + ix;
+					const auto p = key_center(k);
+					if(p.x < walls_lo.x || p.y < walls_lo.y
+						|| p.x > walls_hi.x || p.y > walls_hi.y) {
+						continue;
+					}
+					const auto d = project(a, b, p, i).distance;
+					if(d <= max_way_dist) {
+						near.push_back(Near{k, d, i});
+					}
+				}
+			}
+		}
+		std::sort(near.begin(), near.end(), [](const Near& a, const Near& b) {
+			return a.k < b.k || (a.k == b.k && a.dist < b.dist);
+		});
+		std::vector<std::size_t> cand;
+		std::vector<Pt> courses;
+		for(auto j = 0; j < near.size(); j++) {
+			if(j > 0 && near[j].k == near[j - 1].k) {
+				continue;
+			}
+			const auto seg = near[j].segment;
+			cand.emplace_back(near[j].k);
+			courses.emplace_back(normalized(
+				way.points[(seg + 1) % way.count] - way.points[seg]));
+		}
+
+		// sensed in parallel
+		std::vector<Float> sensed(cand.size() * NRAYS);
+		std::vector<char> ok(cand.size(), 0);
+		parallel(cand.size(), [&](std::size_t lo, std::size_t hi) {
+			auto car = Car<NRAYS, Layout>(Pt(), Pt(0, 1), track->walls);
+			car.grid = track->grid;
+			std::array<Float, NRAYS> raw, s;
+			for(auto j = lo; j < hi; j++) {
+				car.set_pos(key_center(cand[j]), courses[j]);
+				if(intersected(car.path, *track->grid)) {
+					continue;
+				}
+				car.sense();
+				for(auto r = 0; r < NRAYS; r++) {
+					raw[r] = std::min<Float>(car.dists[r], 10);
+				}
+				minmax.norm(raw, s);
+				std::copy(s.cbegin(), s.cend(), sensed.begin() + j * NRAYS);
+				ok[j] = 1;
+			}
+		});
+
+		for(auto j = 0; j < cand.size(); j++) {
+			if(ok[j]) {
+				cells.emplace_back(cand[j]);
+				states.insert(states.end(),
+					sensed.cbegin() + j * NRAYS,
+					sensed.cbegin() + (j + 1) * NRAYS);
+			}
+		}
+		v.assign(cells.size(), 0.0);
+		ac.assign(cells.size() * NA, 0.0);
+		cursor = cells.size();
+	}
+
+	// Evaluates up to budget more cells and returns how many were done.
+	// A finished pass is not repeated until V or Ac publish new weights.
+	std::size_t refresh(const WeightStore& V, const WeightStore& Ac,
+		std::size_t budget)
+	{
+		if(cursor == cells.size()) {
+			const auto version = V.get().version() + Ac.get().version();
+			if(passes > 0 && version == pass_version) {
+				return 0;
+			}
+			cursor = 0;
+			pass_version = version;
+		}
+
+		const auto lo = cursor;
+		const auto hi = std::min(cells.size(), cursor + budget);
+		parallel(hi - lo, [&](std::size_t a, std::size_t b) {
+			WeightReader<NRAYS, 1> v_reader(V);
+			WeightReader<NRAYS, NA> ac_reader(Ac);
+			std::vector<Float> vs(b - a), as((b - a) * NA);
+			const auto* in = states.data() + (lo + a) * NRAYS;
+			v_reader.call_batch(in, b - a, vs.data());
+			ac_reader.call_batch(in, b - a, as.data());
+			std::copy(vs.cbegin(), vs.cend(), v.begin() + lo + a);
+			std::copy(as.cbegin(), as.cend(), ac.begin() + (lo + a) * NA);
+		});
+		cursor = hi;
+		if(cursor == cells.size()) {
+			passes++;
+		}
+		return hi - lo;
+	}
+
+	// Of cell i, 0 <= i < ncells()
+	Pt center(std::size_t i) const
+	{
+		return key_center(cells[i]);
+	}
+
+	Float value(std::size_t i) const
+	{
+		return v[i];
+	}
+
+	Float action(std::size_t i, std::size_t a) const
+	{
+		return ac[i * NA + a];
+	}
+
+	std::size_t ncells() const
+	{
+		return cells.size();
+	}
+
+	unsigned completed_passes() const
+	{
+		return passes;
+	}
+
+	const std::shared_ptr<const Track>& get_track() const
+	{
+		return track;
+	}
+
+private:
+	Pt key_center(std::size_t k) const
+	{
+		return origin + Pt((k % nx + 0.5) * cell, (k / nx + 0.5) * cell);
+	}
+
+	// Cell along an axis of n cells of the coordinate x from the origin
+	std::size_t index(double x, std::size_t n) const
+	{
+		return std::min<std::size_t>(n - 1,
+			static_cast<std::size_t>(std::max(0.0, x / cell)));
+	}
+
+	// Calls f(lo, hi) on nthreads contiguous slices of [0, n)
+	template <typename F>
+	void parallel(std::size_t n, F&& f) const
+	{
+		const auto nt = std::min<std::size_t>(nthreads, (n + 255) / 256);
+		if(nt <= 1) {
+			f(0, n);
+			return;
+		}
+		std::vector<std::thread> threads;
+		for(auto t = 0; t < nt; t++) {
+			threads.emplace_back([&f, t, n, nt]() {
+				f(n * t / nt, n * (t + 1) / nt);
+			});
+		}
+		for(auto& t: threads) {
+			t.join();
+		}
+	}
+
+	std::shared_ptr<const Track> track;
+	unsigned nthreads;
+	Pt origin;          // of the cell numbering: key iy * nx + ix
+	std::size_t nx = 0;
+	std::size_t ny = 0;
+
+	std::vector<std::size_t> cells;  // keys of the cells, in key order
+	std::vector<Float> states;       // NRAYS normalized readings per cell
+	std::vector<Float> v;            // per cell
+	std::vector<Float> ac;           // NA per cell
+
+	std::size_t cursor = 0;
+	std::uint64_t pass_version = 0;
+	unsigned passes = 0;
+};
+
+#endif
@@ -1,3 +1,5 @@
+#include <cstdlib>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -12,9 +14,28 @@
 #include "cacla.h"
 #include "polygon.h"
 #include "shape.h"
+#include "trackpool.h"
+#include "frozen.h"
+#include "trajectory.h"
+#include "trace.h"
+
+// Fits large tracks into the window
+sf::View trackView(const Track& track)
+{
+    auto view_w = 400.0;
+    auto view_c = Pt(0, 0);
+    if(track.grid->nx * track.grid->cell > view_w) {
+        const auto lo = track.grid->origin;
+        const auto hi = track.grid->hi();
+        view_c = 0.5 * (lo + hi);
+        view_w = 1.05 * std::max(hi.x - lo.x, (hi.y - lo.y) * 1820 / 1080);
+    }
+    return sf::View(sf::Vector2f(view_c.x, view_c.y),
+        sf::Vector2f(view_w, -view_w * 1080 / 1820));
+}
 
 template <std::size_t NRAYS, std::size_t NA>
-void runPolygon(Polygon<NRAYS, NA>& polygon)
+void runPolygon(Polygon<NRAYS, NA>& polygon, const std::string& trace_path)
 {
 	sf::Font font;
 	font.loadFromFile("./sansation.ttf");
@@ -28,23 +49,35 @@ void runPolygon(Polygon<NRAYS, NA>& polygon)
 
     const auto& world = polygon.get_world(0);
 
-    FigureShape walls(*(polygon.walls));
-    std::vector<CarShape<NRAYS>> cars;
+    const auto& track = *world.track;
+    std::vector<FigureShape> walls;
+    for(auto i = 0; i < polygon.tracks->size(); i++) {
+        walls.emplace_back(*(*polygon.tracks)[i]->walls);
+    }
+    CarsShape<NRAYS> cars;
+    std::vector<const World<NRAYS, NA>*> car_worlds;
     for(auto i = 1; i < polygon.worlds.size(); i++) {
-    	cars.emplace_back(
-    		CarShape<NRAYS>(polygon.get_world(i).car, sf::Color::Blue)
-    	);
+    	cars.add(polygon.get_world(i).car, sf::Color::Blue);
+    	car_worlds.emplace_back(&polygon.get_world(i));
     }
-    cars.emplace_back(CarShape<NRAYS>(world.car, sf::Color::Red));
+    cars.add(world.car, sf::Color::Red);
+    car_worlds.emplace_back(&world);
 
-    sf::View gView(sf::Vector2f(0,0), sf::Vector2f(400, -400.0 * 1080 / 1820));
+    sf::View gView = trackView(track);
     sf::View tView = window.getDefaultView();
 
+    // 'H' cycles the overlay through off, V, Act[0], Act[1], ...; the
+    // heatmap is only built the first time it is shown
+    std::unique_ptr<Heatmap<NRAYS, NA>> heatmap;
+    std::unique_ptr<HeatmapShape<NRAYS, NA>> heatmap_shape;
+    std::size_t heatmap_channel = 0;
+
     auto n = 0;
 
     // run the program as long as the window is open
     while (window.isOpen())
     {
+        TRACE_SCOPE("frame");
         // check all the window's events that were triggered since the last iteration of the loop
         sf::Event event;
         while (window.pollEvent(event))
@@ -52,8 +85,49 @@ void runPolygon(Polygon<NRAYS, NA>& polygon)
             // "close requested" event: we close the window
             if (event.type == sf::Event::Closed)
                 window.close();
+            if (event.type == sf::Event::KeyPressed
+                && event.key.code == sf::Keyboard::H) {
+                heatmap_channel = (heatmap_channel + 1) % (NA + 2);
+                if (heatmap_channel > 0 && !heatmap) {
+                    heatmap.reset(new Heatmap<NRAYS, NA>(world.track, polygon.minmax));
+                    heatmap_shape.reset(new HeatmapShape<NRAYS, NA>(*heatmap));
+                }
+                if (heatmap_channel > 0) {
+                    heatmap_shape->update(heatmap_channel - 1);
+                }
+            }
+            // 'T' writes the trace so far (with --trace)
+            if (event.type == sf::Event::KeyPressed
+                && event.key.code == sf::Keyboard::T && !trace_path.empty()) {
+                Tracer::instance().write_json(trace_path);
+                std::cout << "trace written to " << trace_path << std::endl;
+            }
+            // 'F' freezes the actor in both modes and reports accuracy
+            if (event.type == sf::Event::KeyPressed
+                && event.key.code == sf::Keyboard::F) {
+                const auto weights = polygon.policy_weights.get().weights();
+                for (auto mode: {FrozenMode::float32, FrozenMode::int8}) {
+                    auto frozen = FrozenPolicy::freeze(weights, mode);
+                    report_accuracy<NRAYS, NA>(std::cout,
+                        polygon.learner.Ac, frozen);
+                    frozen.save(mode == FrozenMode::int8
+                        ? "policy-int8.bin" : "policy-float32.bin");
+                }
+            }
+        }
+
+        auto nn = 100;
+        const auto reward = polygon.run(nn) / nn;
+        n += nn;
+        // with --telemetry the monitor reports progress instead
+        if(!polygon.telemetry_writer) {
+            std::cout << n << ": " << reward << " (episodes " << polygon.epoch
+                << ", stuck " << polygon.stopped_cycles << ", wrong way "
+                << polygon.wander_cycles << ", laps " << polygon.laps << ")"
+                << std::endl;
         }
 
+        TRACE_SCOPE("render");
         // clear the window with black color
         window.clear(sf::Color::White);        
 
@@ -63,10 +137,22 @@ void runPolygon(Polygon<NRAYS, NA>& polygon)
         window.setView(gView);
 
         // draw everything here...
-        window.draw(walls);
-        for(const auto& car: cars) {
-        	window.draw(car);
-    	}
+        // only the cars on the same track as the red one
+        if(heatmap_channel > 0 && heatmap->get_track() == world.track) {
+            if(heatmap->refresh(polygon.value_weights, polygon.policy_weights, 4096)) {
+                heatmap_shape->update(heatmap_channel - 1);
+            }
+            window.draw(*heatmap_shape);
+        }
+        for(auto i = 0; i < walls.size(); i++) {
+            if((*polygon.tracks)[i] == world.track) {
+                window.draw(walls[i]);
+            }
+        }
+        cars.update([&](std::size_t i) {
+            return car_worlds[i]->track == world.track;
+        });
+        window.draw(cars);
 
         window.setView(tView);
         /*
@@ -95,9 +181,14 @@ void runPolygon(Polygon<NRAYS, NA>& polygon)
 			 << "Wheels: " << world.car.wheels_angle << "\n"
 			 << "Act[0]: " << world.last_action[0] << "\n"
 			 << "Act[1]: " << world.last_action[1] << "\n"
-             << "MaxW(V): " << polygon.learner.V.max_q() << "\n"
-             << "MaxW(Ac): " << polygon.learner.Ac.max_q() << "\n";
+             << "MaxW(V): " << polygon.telemetry.max_w_v << "\n"
+             << "MaxW(Ac): " << polygon.telemetry.max_w_ac << "\n";
              ;
+        if(polygon.config.pipeline_depth > 0) {
+            const auto& ps = polygon.pipeline_stats;
+            sstr << "Stale:  " << ps.mean_staleness
+                 << " (max " << ps.max_staleness << ")\n";
+        }
 /*
                                 Reward: {}\nX: {}\nY: {}\n\
                                 Offset: {}\nSigma: {}",
@@ -118,14 +209,132 @@ void runPolygon(Polygon<NRAYS, NA>& polygon)
 
         // end the current frame
         window.display();
+    }
+}
 
-        auto nn = 100;
-        std::cout << (n += nn) << ": " << polygon.run(nn) / nn << std::endl;
+// Plays a trajectory log back; no simulation or networks involved.
+// Space pauses, Left/Right step a tick, Up/Down double/halve the speed,
+// R reverses, Home/End jump to the ends.
+template <std::size_t NRAYS, std::size_t NA>
+void runReplay(const TrajectoryLog<NRAYS, NA>& log)
+{
+	if(log.ticks() == 0) {
+		std::cout << "empty trajectory log" << std::endl;
+		return;
+	}
+
+	TrackPool pool;
+	for(const auto& name: log.track_names) {
+		pool.load_named(name);
+	}
+
+	sf::Font font;
+	font.loadFromFile("./sansation.ttf");
+
+    sf::ContextSettings settings;
+    settings.antialiasingLevel = 8;
+
+    sf::RenderWindow window(sf::VideoMode(1820, 1080, 32),
+    	"Polygon (C++) - replay",
+    	sf::Style::Default, settings);
+
+    std::vector<FigureShape> walls;
+    for(auto i = 0; i < pool.size(); i++) {
+        walls.emplace_back(*pool[i]->walls);
+    }
+
+    // cars are only used for their pose
+    std::vector<Car<NRAYS>> car_poses;
+    car_poses.reserve(log.nworlds);
+    CarsShape<NRAYS> cars;
+    for(auto j = 0; j < log.nworlds; j++) {
+        car_poses.emplace_back(Pt(), Pt(0, 1), pool[0]->walls);
+    }
+    for(auto j = 1; j < log.nworlds; j++) {
+        cars.add(car_poses[j], sf::Color::Blue);
+    }
+    cars.add(car_poses[0], sf::Color::Red);
+
+    auto shown_track = log.tick(0)[0].track;
+    sf::View gView = trackView(*pool[shown_track]);
+    sf::View tView = window.getDefaultView();
+
+    const auto last = static_cast<double>(log.ticks() - 1);
+    auto pos = 0.0;
+    auto speed = 1.0;
+    auto paused = false;
+
+    while (window.isOpen())
+    {
+        sf::Event event;
+        while (window.pollEvent(event))
+        {
+            if (event.type == sf::Event::Closed)
+                window.close();
+            if (event.type != sf::Event::KeyPressed)
+                continue;
+            switch (event.key.code) {
+            case sf::Keyboard::Space: paused = !paused; break;
+            case sf::Keyboard::Right: paused = true; pos += 1; break;
+            case sf::Keyboard::Left:  paused = true; pos -= 1; break;
+            case sf::Keyboard::Up:    speed *= 2; break;
+            case sf::Keyboard::Down:  speed /= 2; break;
+            case sf::Keyboard::R:     speed = -speed; break;
+            case sf::Keyboard::Home:  pos = 0; break;
+            case sf::Keyboard::End:   pos = last; break;
+            default: break;
+            }
+        }
+        if (!paused) {
+            pos += speed;
+        }
+        pos = std::min(std::max(pos, 0.0), last);
+
+        const auto t = static_cast<std::size_t>(pos);
+        const auto* recs = log.tick(t);
+        for(auto j = 0; j < log.nworlds; j++) {
+            car_poses[j].center = Pt(recs[j].x, recs[j].y);
+            car_poses[j].course = Pt(recs[j].course_x, recs[j].course_y);
+        }
+        if(recs[0].track != shown_track) {
+            shown_track = recs[0].track;
+            gView = trackView(*pool[shown_track]);
+        }
+
+        window.clear(sf::Color::White);
+        window.setView(gView);
+        window.draw(walls[shown_track]);
+        cars.update([&](std::size_t i) {
+            return recs[(i + 1) % log.nworlds].track == shown_track;
+        });
+        window.draw(cars);
+
+        window.setView(tView);
+		std::stringstream sstr;
+		sstr << "Tick:   " << t << " / " << log.ticks() << "\n"
+			 << "Replay: " << (paused ? 0.0 : speed) << "x\n"
+			 << "Episode: " << recs[0].episode << "\n"
+			 << "Speed:  " << recs[0].speed << "\n"
+			 << "Wheels: " << recs[0].wheels_angle << "\n";
+		for(auto i = 0; i < NA; i++) {
+			sstr << "Act[" << i << "]: " << recs[0].action[i] << "\n";
+		}
+		sstr << "Reward: " << recs[0].reward << "\n";
+
+		auto text = sf::Text();
+		text.setFont(font);
+		text.setCharacterSize(24);
+		text.setString(sstr.str());
+		text.setPosition(1200, 30);
+		text.setColor(sf::Color::Black);
+		window.draw(text);
+
+        window.display();
     }
 }
 
-int main()
-{	
+int main(int argc, char** argv)
+{
 	std::cout << Pt(3, 4).norm() << "\n";
 	std::cout << Pt(1, 2) - Pt(3, 4) << "\n";
 	std::cout << 3 * Pt(3, 4) << "\n";
@@ -136,6 +345,59 @@ int main()
 	std::cout << Isx(Pt(1, 2), 3) << "\n";
 	std::cout << Path(std::vector<Sect>(5, Sect())) << "\n";
 
-	Polygon<36, 2> polygon("123");
-	runPolygon(polygon);
+	// polygon [--record FILE] [--replay FILE] [--load FILE]
+	//         [--pipeline DEPTH] [--trace FILE] [--telemetry NAME]
+	//         [--dt SECONDS] [--worlds N] [--arena] [TRACK...]
+	std::string record, replay, load, trace, telemetry;
+	PolygonConfig config;
+	auto tracks = std::make_shared<TrackPool>();
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if(arg == "--record" && i + 1 < argc) {
+			record = argv[++i];
+		} else if(arg == "--replay" && i + 1 < argc) {
+			replay = argv[++i];
+		} else if(arg == "--load" && i + 1 < argc) {
+			load = argv[++i];
+		} else if(arg == "--trace" && i + 1 < argc) {
+			trace = argv[++i];
+		} else if(arg == "--telemetry" && i + 1 < argc) {
+			telemetry = argv[++i];
+		} else if(arg == "--worlds" && i + 1 < argc) {
+			config.nworlds = std::atoi(argv[++i]);
+		} else if(arg == "--arena") {
+			config.shared_arena = true;
+		} else if(arg == "--dt" && i + 1 < argc) {
+			config.dt = std::atof(argv[++i]);
+		} else if(arg == "--pipeline" && i + 1 < argc) {
+			config.pipeline_depth = std::atoi(argv[++i]);
+		} else {
+			tracks->load(arg);
+		}
+	}
+
+	if(!trace.empty()) {
+		Tracer::instance().start();
+		Tracer::instance().thread_name("main");
+		Tracer::instance().dump_at_exit(trace);
+	}
+
+	if(!replay.empty()) {
+		runReplay(TrajectoryLog<36, 2>(replay));
+		return 0;
+	}
+	if(tracks->empty()) {
+		tracks->add(Track::clover());
+	}
+	Polygon<36, 2> polygon("123", config, tracks);
+	if(!load.empty()) {
+		polygon.learner.load(load);
+	}
+	if(!record.empty()) {
+		polygon.record_to(record);
+	}
+	if(!telemetry.empty()) {
+		polygon.publish_to(telemetry);
+	}
+	runPolygon(polygon, trace);
 }
@@ -0,0 +1,75 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "geom.h"
+#include "track.h"
+#include "grid.h"
+#include "trackgen.h"
+#include "trackfile.h"
+
+void usage()
+{
+	std::cerr << "usage: mktrack FILE [--segments N] [--seed N] [--width D]\n"
+			  << "               [--jitter J] [--clover]\n"
+			  << "--clover takes everything but --segments\n";
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2) {
+		usage();
+		return 1;
+	}
+	const std::string file = argv[1];
+	TrackGenParams params;
+	auto use_clover = false;
+	auto has_segments = false;
+	auto has_jitter = false;
+
+	for(auto i = 2; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto has_value = i + 1 < argc;
+		if(arg == "--segments" && has_value) {
+			params.segments = std::atoi(argv[++i]);
+			has_segments = true;
+		} else if(arg == "--seed" && has_value) {
+			params.seed = std::atoi(argv[++i]);
+		} else if(arg == "--width" && has_value) {
+			params.half_width = 0.5 * std::atof(argv[++i]);
+		} else if(arg == "--jitter" && has_value) {
+			params.jitter = std::atof(argv[++i]);
+			has_jitter = true;
+		} else if(arg == "--clover") {
+			use_clover = true;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if(use_clover && has_segments) {
+		usage();
+		return 1;
+	}
+
+	GeneratedTrack track;
+	if(use_clover) {
+		// --jitter is in half widths, the clover's in units of its scale;
+		// without it the clover keeps its usual walls
+		const auto scale = 10.0;
+		const auto jitter = has_jitter
+			? params.jitter * params.half_width / scale : 0.15;
+		track.walls = clover(params.half_width, scale, params.seed, jitter);
+		for(const auto& p: clover_data) {
+			track.way_points.emplace_back(scale * p);
+		}
+	} else {
+		track = generate_track(params);
+	}
+	const auto grid = SectGrid::build(track.walls);
+	save_track(file, track.walls, track.way_points, grid);
+
+	std::cout << file << ": " << grid.nsects << " wall sections, "
+			  << track.way_points.size() << " way points, "
+			  << grid.nx << "x" << grid.ny << " grid cells\n";
+}
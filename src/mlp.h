@@ -0,0 +1,290 @@
+#ifndef __POLYGON_MLP_H
+#define __POLYGON_MLP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "geom.h"
+
+// Plain copy of the weights of an MLPNet: fully connected layers with
+// tanh between them and a linear output. Unlike the tiny-dnn network it
+// came from, it is only read by forward(), so any number of threads can
+// evaluate it at once as long as each brings its own scratch.
+struct MLPWeights
+{
+	std::vector<std::size_t> sizes;
+	std::vector<std::vector<Float>> w; // w[l][i * sizes[l] + c]: input c -> output i
+	std::vector<std::vector<Float>> b; // b[l][i]
+
+	std::size_t n_in() const
+	{
+		return sizes.front();
+	}
+
+	std::size_t n_out() const
+	{
+		return sizes.back();
+	}
+
+	std::size_t max_width() const
+	{
+		return *std::max_element(sizes.cbegin(), sizes.cend());
+	}
+
+	// Xavier-uniform weights and zero biases, tiny-dnn's default init
+	template <typename G>
+	static MLPWeights xavier(const std::vector<std::size_t>& asizes, G& gen)
+	{
+		MLPWeights res;
+		res.sizes = asizes;
+		for(auto l = 0; l + 1 < asizes.size(); l++) {
+			const auto ni = asizes[l];
+			const auto no = asizes[l + 1];
+			const auto r = std::sqrt(6.0 / (ni + no));
+			std::uniform_real_distribution<Float> u(-r, r);
+			res.w.emplace_back(ni * no);
+			for(auto& x: res.w.back()) {
+				x = u(gen);
+			}
+			res.b.emplace_back(no, 0.0);
+		}
+		return res;
+	}
+
+	// Evaluates n inputs (rows of n_in() values) into n rows of n_out()
+	// values. scratch is resized to 2 * n * max_width() if needed.
+	void forward(const Float* in, std::size_t n, Float* out,
+		std::vector<Float>& scratch) const
+	{
+		const auto width = max_width();
+		if(scratch.size() < 2 * n * width) {
+			scratch.resize(2 * n * width);
+		}
+		auto* cur = scratch.data();
+		auto* nxt = scratch.data() + n * width;
+		const auto nl = w.size();
+		for(auto l = 0; l < nl; l++) {
+			const auto ni = sizes[l];
+			const auto no = sizes[l + 1];
+			const auto& wl = w[l];
+			const auto& bl = b[l];
+			const auto last = l + 1 == nl;
+			for(auto r = 0; r < n; r++) {
+				const auto* x = (l == 0) ? in + r * ni : cur + r * width;
+				auto* y = last ? out + r * no : nxt + r * width;
+				for(auto i = 0; i < no; i++) {
+					const auto* wi = wl.data() + i * ni;
+					auto z = bl[i];
+					for(auto c = 0; c < ni; c++) {
+						z += wi[c] * x[c];
+					}
+					y[i] = last ? z : std::tanh(z);
+				}
+			}
+			std::swap(cur, nxt);
+		}
+	}
+};
+
+// Gradient (or momentum) of every weight of an MLPWeights, same layout
+struct MLPGrad
+{
+	std::vector<std::vector<Float>> w;
+	std::vector<std::vector<Float>> b;
+
+	void reset(const MLPWeights& net)
+	{
+		w.resize(net.w.size());
+		b.resize(net.b.size());
+		for(auto l = 0; l < net.w.size(); l++) {
+			w[l].assign(net.w[l].size(), 0.0);
+			b[l].assign(net.b[l].size(), 0.0);
+		}
+	}
+
+	void zero()
+	{
+		for(auto& x: w) {
+			std::fill(x.begin(), x.end(), 0.0);
+		}
+		for(auto& x: b) {
+			std::fill(x.begin(), x.end(), 0.0);
+		}
+	}
+
+	void add(const MLPGrad& o)
+	{
+		for(auto l = 0; l < w.size(); l++) {
+			for(auto i = 0; i < w[l].size(); i++) {
+				w[l][i] += o.w[l][i];
+			}
+			for(auto i = 0; i < b[l].size(); i++) {
+				b[l][i] += o.b[l][i];
+			}
+		}
+	}
+};
+
+// Adds weight * the gradient of the squared error of net(x) against
+// target (scaled like tiny-dnn's mse) to g, and returns net(x)[0].
+// scratch is resized as needed.
+inline Float mlp_backprop(const MLPWeights& net, const Float* x,
+	const Float* target, Float weight, MLPGrad& g, std::vector<Float>& scratch)
+{
+	const auto nl = net.w.size();
+	const auto width = net.max_width();
+	// activations of every layer (layer 0 is x), then two delta rows
+	std::size_t nact = 0;
+	for(auto s: net.sizes) {
+		nact += s;
+	}
+	if(scratch.size() < nact + 2 * width) {
+		scratch.resize(nact + 2 * width);
+	}
+	auto* a = scratch.data();
+	std::copy(x, x + net.sizes[0], a);
+	for(auto l = 0; l < nl; l++) {
+		const auto ni = net.sizes[l];
+		const auto no = net.sizes[l + 1];
+		const auto* wl = net.w[l].data();
+		auto* y = a + ni;
+		for(auto i = 0; i < no; i++) {
+			auto z = net.b[l][i];
+			for(auto c = 0; c < ni; c++) {
+				z += wl[i * ni + c] * a[c];
+			}
+			y[i] = (l + 1 == nl) ? z : std::tanh(z);
+		}
+		a = y;
+	}
+	const auto out = a[0];
+
+	auto* delta = scratch.data() + nact;
+	auto* prev = delta + width;
+	const auto no = net.sizes.back();
+	for(auto i = 0; i < no; i++) {
+		delta[i] = weight * 2.0 * (a[i] - target[i]) / no;
+	}
+	for(auto l = nl; l-- > 0;) {
+		const auto ni = net.sizes[l];
+		const auto no = net.sizes[l + 1];
+		const auto* wl = net.w[l].data();
+		auto* gw = g.w[l].data();
+		a -= ni; // now the input of layer l
+		for(auto i = 0; i < no; i++) {
+			g.b[l][i] += delta[i];
+			for(auto c = 0; c < ni; c++) {
+				gw[i * ni + c] += delta[i] * a[c];
+			}
+		}
+		if(l > 0) {
+			for(auto c = 0; c < ni; c++) {
+				auto d = 0.0;
+				for(auto i = 0; i < no; i++) {
+					d += wl[i * ni + c] * delta[i];
+				}
+				prev[c] = d * (1 - a[c] * a[c]);
+			}
+			std::swap(delta, prev);
+		}
+	}
+	return out;
+}
+
+// Momentum SGD as tiny-dnn's momentum optimizer does it:
+// m = mu * m - alpha * g; w += m
+inline void momentum_step(MLPWeights& net, MLPGrad& mom, const MLPGrad& g,
+	Float alpha, Float mu)
+{
+	auto step = [alpha, mu](std::vector<Float>& w, std::vector<Float>& m,
+		const std::vector<Float>& d) {
+		for(auto i = 0; i < w.size(); i++) {
+			m[i] = mu * m[i] - alpha * d[i];
+			w[i] += m[i];
+		}
+	};
+	for(auto l = 0; l < net.w.size(); l++) {
+		step(net.w[l], mom.w[l], g.w[l]);
+		step(net.b[l], mom.b[l], g.b[l]);
+	}
+}
+
+constexpr char MLP_MAGIC[8] = {'P', 'L', 'G', 'M', 'L', 'P', 'W', '1'};
+
+// File: magic, number of nets, then per net the number of sizes, sizes,
+// and every layer's w and b as doubles
+inline void save_weights(const std::string& path,
+	const std::vector<MLPWeights>& nets)
+{
+	std::ofstream ofs(path, std::ios::binary);
+	auto put = [&ofs](std::uint32_t x) {
+		ofs.write(reinterpret_cast<const char*>(&x), sizeof(x));
+	};
+	ofs.write(MLP_MAGIC, sizeof(MLP_MAGIC));
+	put(nets.size());
+	for(const auto& net: nets) {
+		put(net.sizes.size());
+		for(auto s: net.sizes) {
+			put(s);
+		}
+		for(auto l = 0; l < net.w.size(); l++) {
+			ofs.write(reinterpret_cast<const char*>(net.w[l].data()),
+				sizeof(Float) * net.w[l].size());
+			ofs.write(reinterpret_cast<const char*>(net.b[l].data()),
+				sizeof(Float) * net.b[l].size());
+		}
+	}
+	if(!ofs) {
+		throw std::runtime_error("can't write weights " + path);
+	}
+}
+
+inline std::vector<MLPWeights> load_weights(const std::string& path)
+{
+	std::ifstream ifs(path, std::ios::binary);
+	auto get = [&ifs]() {
+		std::uint32_t x = 0;
+		ifs.read(reinterpret_cast<char*>(&x), sizeof(x));
+		return x;
+	};
+	char magic[sizeof(MLP_MAGIC)];
+	ifs.read(magic, sizeof(magic));
+	const auto n = get();
+	if(!ifs || std::memcmp(magic, MLP_MAGIC, sizeof(magic)) != 0 || n > 64) {
+		throw std::runtime_error("bad weights file " + path);
+	}
+	std::vector<MLPWeights> nets(n);
+	for(auto& net: nets) {
+		const auto nsizes = get();
+		if(!ifs || nsizes < 2 || nsizes > 64) {
+			throw std::runtime_error("bad weights file " + path);
+		}
+		for(auto i = 0; i < nsizes; i++) {
+			net.sizes.emplace_back(get());
+			if(net.sizes.back() == 0 || net.sizes.back() > 65536) {
+				throw std::runtime_error("bad weights file " + path);
+			}
+		}
+		for(auto l = 0; l + 1 < nsizes; l++) {
+			net.w.emplace_back(net.sizes[l] * net.sizes[l + 1]);
+			net.b.emplace_back(net.sizes[l + 1]);
+			ifs.read(reinterpret_cast<char*>(net.w[l].data()),
+				sizeof(Float) * net.w[l].size());
+			ifs.read(reinterpret_cast<char*>(net.b[l].data()),
+				sizeof(Float) * net.b[l].size());
+		}
+	}
+	if(!ifs) {
+		throw std::runtime_error("bad weights file " + path);
+	}
+	return nets;
+}
+
+#endif
@@ -0,0 +1,113 @@
+// Prints the live metrics a trainer (polygon --telemetry NAME) publishes
+// to shared memory. Only reads the segment, so it can poll at any rate
+// without slowing the trainer down.
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "telemetry.h"
+
+void usage()
+{
+	std::cerr << "usage: monitor [NAME] [--interval MS] [--once]\n";
+}
+
+// One right-aligned column, always at least a space apart from the last
+template <typename T>
+void col(int width, const T& value)
+{
+	std::cout << ' ' << std::setw(width - 1) << value;
+}
+
+void print_header()
+{
+	col(10, "ticks");
+	col(10, "steps/s");
+	col(10, "reward");
+	col(8, "sigma");
+	col(10, "td mean");
+	col(10, "td rms");
+	col(10, "td max");
+	col(7, "Ac/st");
+	col(10, "maxW(V)");
+	col(10, "maxW(Ac)");
+	for(auto name: TELEMETRY_PHASE_NAMES) {
+		col(8, name);
+	}
+	col(7, "stale");
+	std::cout << "\n";
+}
+
+void print(const TelemetryData& d)
+{
+	// general notation, so a diverging learner doesn't break the columns
+	std::cout << std::setprecision(4);
+	col(10, d.ticks);
+	col(10, static_cast<long>(d.steps_per_sec));
+	col(10, d.avg_reward);
+	col(8, d.sigma);
+	col(10, d.td_mean);
+	col(10, d.td_rms);
+	col(10, d.td_max);
+	col(7, d.actor_updates);
+	col(10, d.max_w_v);
+	col(10, d.max_w_ac);
+	// phases in us per world step
+	for(auto us: d.phase_us) {
+		col(8, us);
+	}
+	col(7, d.staleness);
+	std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::string name = TELEMETRY_DEFAULT_NAME;
+	unsigned interval = 1000;
+	auto once = false;
+
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if(arg == "--interval" && i + 1 < argc) {
+			interval = std::atoi(argv[++i]);
+		} else if(arg == "--once") {
+			once = true;
+		} else if(!arg.empty() && arg[0] != '-') {
+			name = arg;
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	try {
+		TelemetryReader reader(name);
+		TelemetryData d;
+		std::uint64_t last_seq = 0;
+		auto lines = 0;
+		for(;;) {
+			const auto seq = reader.read(d);
+			if(seq != last_seq) {
+				last_seq = seq;
+				if(lines++ % 20 == 0) {
+					print_header();
+				}
+				print(d);
+				if(once) {
+					break;
+				}
+			}
+			if(seq > 0 && !d.running) {
+				std::cout << "trainer stopped\n";
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+		}
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+}
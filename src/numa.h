@@ -0,0 +1,117 @@
+#ifndef __POLYGON_NUMA_H
+#define __POLYGON_NUMA_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// CPUs of the NUMA nodes, as sysfs lists them. Only CPUs this process
+// may run on count, and nodes without any are dropped; with no NUMA
+// information all of them make one node.
+struct CpuTopology
+{
+	std::vector<std::vector<int>> nodes; // CPUs of every node
+
+	static CpuTopology detect()
+	{
+		std::vector<int> allowed;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+			for(auto c = 0; c < CPU_SETSIZE; c++) {
+				if(CPU_ISSET(c, &set)) {
+					allowed.push_back(c);
+				}
+			}
+		}
+		if(allowed.empty()) {
+			allowed.push_back(0);
+		}
+
+		CpuTopology res;
+		for(auto n = 0; ; n++) {
+			std::ifstream f("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+			if(!f) {
+				break;
+			}
+			std::string list;
+			std::getline(f, list);
+			std::vector<int> cpus;
+			for(auto c: parse_list(list)) {
+				if(std::binary_search(allowed.cbegin(), allowed.cend(), c)) {
+					cpus.push_back(c);
+				}
+			}
+			if(!cpus.empty()) {
+				res.nodes.push_back(cpus);
+			}
+		}
+		if(res.nodes.empty()) {
+			res.nodes.push_back(allowed);
+		}
+		return res;
+	}
+
+	std::size_t ncpus() const
+	{
+		auto n = std::size_t(0);
+		for(const auto& cpus: nodes) {
+			n += cpus.size();
+		}
+		return n;
+	}
+
+	// Node of each of nthreads threads: consecutive threads share a node,
+	// and the nodes get shares as even as their CPU counts allow
+	std::vector<unsigned> place(unsigned nthreads) const
+	{
+		std::vector<unsigned> res;
+		const auto total = ncpus();
+		auto cpus_before = std::size_t(0);
+		for(auto n = 0; n < nodes.size(); n++) {
+			cpus_before += nodes[n].size();
+			while(res.size() < nthreads && res.size() * total < cpus_before * nthreads) {
+				res.push_back(n);
+			}
+		}
+		return res;
+	}
+
+	// "0-3,8,10-11" -> 0 1 2 3 8 10 11
+	static std::vector<int> parse_list(const std::string& list)
+	{
+		std::vector<int> res;
+		std::istringstream in(list);
+		std::string range;
+		while(std::getline(in, range, ',')) {
+			if(range.empty()) {
+				continue;
+			}
+			const auto dash = range.find('-');
+			const auto lo = std::stoi(range.substr(0, dash));
+			const auto hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+			for(auto c = lo; c <= hi; c++) {
+				res.push_back(c);
+			}
+		}
+		return res;
+	}
+};
+
+// Pins the calling thread to the CPUs given; false if the OS refuses
+inline bool pin_this_thread(const std::vector<int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(auto c: cpus) {
+		CPU_SET(c, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#endif
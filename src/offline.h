@@ -0,0 +1,227 @@
+#ifndef __POLYGON_OFFLINE_H
+#define __POLYGON_OFFLINE_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mlp.h"
+#include "polygon.h"
+#include "trajectory.h"
+#include "workers.h"
+
+struct OfflineConfig
+{
+	double gamma = 0.99;    // of V(s'); learn_reward was discounted when recorded
+	double alpha = 0.1;     // learning rate, on the batch mean gradient
+	double momentum = 0.95;
+	double beta = 0.001;
+	std::size_t batch = 256;
+	std::size_t shard = 32; // samples per task; fixes the summation order
+	unsigned nthreads = std::thread::hardware_concurrency();
+	unsigned seed = 1;
+};
+
+struct OfflineStats
+{
+	std::size_t samples = 0;
+	double critic_loss = 0; // mean squared TD error
+	double actor_share = 0; // fraction of samples with a positive TD error
+	double seconds = 0;
+};
+
+// Fits V and the CACLA actor to (s, a, r, s') transitions read from
+// trajectory logs, without any World. Consecutive records of a world
+// make a transition when they belong to the same episode. Like online,
+// r is the normalized reward discounted over the steps the action was
+// held for, and V(s') is discounted by gamma^steps.
+//
+// The logs stay mapped and only an index of record pairs is kept in
+// memory; every epoch shuffles it and walks it in minibatches. A batch
+// is cut into shards of a fixed size, whose gradients are computed in
+// parallel and then summed pairwise in shard order, so the result
+// depends on the seed and the batch/shard sizes but not on the number
+// of threads.
+//
+// Like Cacla::step(), the actor moves towards the action taken when the
+// TD error is positive, ceil(td / sqrt(var)) times as much; var is
+// taken at the start of the batch and updated after it in sample order.
+template <std::size_t NRAYS, std::size_t NA>
+class OfflineTrainer
+{
+public:
+	typedef TickRecord<NRAYS, NA> Record;
+
+	OfflineTrainer(const OfflineConfig& aconfig, const MinMax<NRAYS>& aminmax,
+		MLPWeights av, MLPWeights aac)
+		: config(aconfig), minmax(aminmax),
+		  v(std::move(av)), ac(std::move(aac)),
+		  pool(aconfig.nthreads), gen(aconfig.seed)
+	{
+		if(v.n_in() != NRAYS || v.n_out() != 1
+			|| ac.n_in() != NRAYS || ac.n_out() != NA) {
+			throw std::runtime_error("OfflineTrainer: network shapes don't match");
+		}
+		config.shard = std::max<std::size_t>(config.shard, 1);
+		config.batch = std::max(config.batch, config.shard);
+		v_mom.reset(v);
+		ac_mom.reset(ac);
+		shards.resize((config.batch + config.shard - 1) / config.shard);
+		for(auto& s: shards) {
+			s.gv.reset(v);
+			s.gac.reset(ac);
+			s.td.reserve(config.shard);
+		}
+	}
+
+	// Maps a log and indexes its transitions; returns how many it added
+	std::size_t add_log(const std::string& path)
+	{
+		logs.emplace_back(path);
+		const auto& log = logs.back();
+		const auto before = transitions.size();
+		for(auto t = 1; t < log.ticks(); t++) {
+			const auto* prev = log.tick(t - 1);
+			const auto* cur = log.tick(t);
+			for(auto j = 0; j < log.nworlds; j++) {
+				if(prev[j].episode == cur[j].episode) {
+					transitions.push_back({prev + j, cur + j});
+				}
+			}
+		}
+		return transitions.size() - before;
+	}
+
+	std::size_t size() const
+	{
+		return transitions.size();
+	}
+
+	OfflineStats train_epoch()
+	{
+		const auto start = std::chrono::steady_clock::now();
+		std::shuffle(transitions.begin(), transitions.end(), gen);
+
+		OfflineStats stats;
+		auto sum_td2 = 0.0;
+		std::size_t nactor = 0;
+		for(std::size_t lo = 0; lo < transitions.size(); lo += config.batch) {
+			const auto n = std::min(config.batch, transitions.size() - lo);
+			const auto nshards = (n + config.shard - 1) / config.shard;
+			const auto sd = std::sqrt(var);
+
+			pool.run(nshards, [&](std::size_t k) {
+				auto& s = shards[k];
+				s.gv.zero();
+				s.gac.zero();
+				s.td.clear();
+				s.td2 = 0;
+				s.nactor = 0;
+				const auto a = lo + k * config.shard;
+				const auto b = std::min(a + config.shard, lo + n);
+				for(auto i = a; i < b; i++) {
+					shard_sample(s, transitions[i], sd);
+				}
+			});
+
+			// pairwise in shard order, whatever thread computed what
+			pool.reduce(nshards, [&](std::size_t i, std::size_t j) {
+				shards[i].gv.add(shards[j].gv);
+				shards[i].gac.add(shards[j].gac);
+			});
+			apply(v, v_mom, shards[0].gv, 1.0 / n);
+			apply(ac, ac_mom, shards[0].gac, 1.0 / n);
+
+			for(auto k = 0; k < nshards; k++) {
+				sum_td2 += shards[k].td2;
+				nactor += shards[k].nactor;
+				for(auto td: shards[k].td) {
+					var = (1 - config.beta) * var + config.beta * td * td;
+				}
+			}
+		}
+
+		stats.samples = transitions.size();
+		if(stats.samples > 0) {
+			stats.critic_loss = sum_td2 / stats.samples;
+			stats.actor_share = static_cast<double>(nactor) / stats.samples;
+		}
+		stats.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+		return stats;
+	}
+
+	const MLPWeights& v_weights() const
+	{
+		return v;
+	}
+
+	const MLPWeights& ac_weights() const
+	{
+		return ac;
+	}
+
+private:
+	struct Transition
+	{
+		const Record* prev;
+		const Record* cur;
+	};
+
+	struct Shard
+	{
+		MLPGrad gv, gac;
+		std::vector<Float> td; // positive TD errors, in sample order
+		double td2 = 0;
+		std::size_t nactor = 0;
+		std::vector<Float> scratch;
+	};
+
+	void shard_sample(Shard& s, const Transition& tr, Float sd) const
+	{
+		std::array<Float, NRAYS> raw, st, new_st;
+		std::copy(tr.prev->state, tr.prev->state + NRAYS, raw.begin());
+		minmax.norm(raw, st);
+		std::copy(tr.cur->state, tr.cur->state + NRAYS, raw.begin());
+		minmax.norm(raw, new_st);
+		Float new_v;
+		v.forward(new_st.data(), 1, &new_v, s.scratch);
+		const Float target = tr.cur->learn_reward
+			+ std::pow(config.gamma, tr.cur->steps) * new_v;
+		const auto td = target - mlp_backprop(v, st.data(), &target, 1.0,
+			s.gv, s.scratch);
+		s.td2 += td * td;
+		if(td > 0) {
+			std::array<Float, NA> a;
+			std::copy(tr.cur->action, tr.cur->action + NA, a.begin());
+			mlp_backprop(ac, st.data(), a.data(), std::ceil(td / sd),
+				s.gac, s.scratch);
+			s.td.emplace_back(td);
+			s.nactor++;
+		}
+	}
+
+	void apply(MLPWeights& net, MLPGrad& mom, const MLPGrad& g, Float scale) const
+	{
+		momentum_step(net, mom, g, config.alpha * scale, config.momentum);
+	}
+
+	OfflineConfig config;
+	MinMax<NRAYS> minmax;
+	MLPWeights v, ac;
+	MLPGrad v_mom, ac_mom;
+	double var = 1.0;
+
+	std::vector<TrajectoryLog<NRAYS, NA>> logs;
+	std::vector<Transition> transitions;
+	std::vector<Shard> shards;
+	WorkerPool pool;
+	std::mt19937 gen;
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef __POLYGON_PIPELINE_H
+#define __POLYGON_PIPELINE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mlp.h"
+
+// Bounded ring of preallocated slots handed from one producer thread to
+// one consumer thread. The producer fills acquire_write() and passes it
+// on with commit_write(); it blocks while all slots are still waiting to
+// be consumed. With depth 2 this is plain double buffering.
+template <typename T>
+class HandoffRing
+{
+public:
+	HandoffRing(std::size_t depth, const T& proto)
+		: slots(std::max<std::size_t>(depth, 1), proto)
+	{}
+
+	std::size_t depth() const
+	{
+		return slots.size();
+	}
+
+	T& acquire_write()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this]() { return produced - consumed < slots.size(); });
+		return slots[produced % slots.size()];
+	}
+
+	void commit_write()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			produced++;
+		}
+		cv.notify_all();
+	}
+
+	// nullptr once the ring is closed and drained
+	T* acquire_read()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this]() { return closed || produced > consumed; });
+		if(produced == consumed) {
+			return nullptr;
+		}
+		return &slots[consumed % slots.size()];
+	}
+
+	void commit_read()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			consumed++;
+		}
+		cv.notify_all();
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		cv.notify_all();
+	}
+
+private:
+	std::vector<T> slots;
+	std::size_t produced = 0;
+	std::size_t consumed = 0;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable cv;
+};
+
+// Latest weights published by one thread for any number of readers on
+// others, without locks. Snapshots live in a fixed set of slots. The
+// writer fills a slot no reader holds and makes it current with one
+// atomic store; a reader pins the current slot by counting itself in,
+// and the writer leaves pinned slots alone. Publishing reuses the slot's
+// buffers, so it doesn't allocate once the shapes settle.
+class WeightStore
+{
+	struct Slot
+	{
+		MLPWeights weights;
+		std::size_t ticks = 0;
+		std::uint64_t version = 0;
+		mutable std::atomic<unsigned> readers{0};
+	};
+
+public:
+	// Pins one published slot until destroyed; move-only
+	class Snapshot
+	{
+	public:
+		Snapshot(Snapshot&& other) noexcept
+			: slot(other.slot)
+		{
+			other.slot = nullptr;
+		}
+
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+		Snapshot& operator=(Snapshot&&) = delete;
+
+		~Snapshot()
+		{
+			if(slot) {
+				slot->readers.fetch_sub(1, std::memory_order_release);
+			}
+		}
+
+		const MLPWeights& weights() const
+		{
+			return slot->weights;
+		}
+
+		// Ticks of experience included, as given to publish()
+		std::size_t ticks() const
+		{
+			return slot->ticks;
+		}
+
+		std::uint64_t version() const
+		{
+			return slot->version;
+		}
+
+	private:
+		friend class WeightStore;
+
+		explicit Snapshot(const Slot* aslot) : slot(aslot) {}
+
+		const Slot* slot;
+	};
+
+	// One slot per reader that may hold a snapshot, plus two, lets every
+	// publish() succeed
+	explicit WeightStore(const MLPWeights& initial, std::size_t nslots = 3)
+		: slots(new Slot[std::max<std::size_t>(nslots, 2)]),
+		  nslots(std::max<std::size_t>(nslots, 2))
+	{
+		for(auto i = 0; i < this->nslots; i++) {
+			slots[i].weights = initial;
+		}
+	}
+
+	// fill(MLPWeights&) writes the new weights over an older snapshot.
+	// Only one thread may publish. Returns false, leaving the current
+	// snapshot in place, when readers pin every other slot.
+	template <typename F>
+	bool publish(F fill, std::size_t ticks)
+	{
+		const auto cur = current.load(std::memory_order_relaxed);
+		for(auto i = 0; i < nslots; i++) {
+			auto& slot = slots[i];
+			if(i == cur || slot.readers.load(std::memory_order_seq_cst) > 0) {
+				continue;
+			}
+			fill(slot.weights);
+			slot.ticks = ticks;
+			slot.version = ++version_;
+			current.store(i, std::memory_order_seq_cst);
+			return true;
+		}
+		return false;
+	}
+
+	bool publish(const MLPWeights& w, std::size_t ticks)
+	{
+		return publish([&w](MLPWeights& dst) { dst = w; }, ticks);
+	}
+
+	// The latest snapshot. Any thread, any number at once.
+	Snapshot get() const
+	{
+		for(;;) {
+			const auto i = current.load(std::memory_order_seq_cst);
+			auto& slot = slots[i];
+			slot.readers.fetch_add(1, std::memory_order_seq_cst);
+			// the writer may have started refilling the slot before the
+			// pin was seen; it is only safe if it is still current
+			if(current.load(std::memory_order_seq_cst) == i) {
+				return Snapshot(&slot);
+			}
+			slot.readers.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	std::unique_ptr<Slot[]> slots;
+	const std::size_t nslots;
+	std::atomic<std::size_t> current{0};
+	std::uint64_t version_ = 0; // writer only
+};
+
+// Inference on the latest weights of a WeightStore. Each thread keeps
+// its own reader, which owns the scratch buffers.
+template <std::size_t NI, std::size_t NO>
+class WeightReader
+{
+public:
+	explicit WeightReader(const WeightStore& astore) : store(astore) {}
+
+	template <typename X>
+	std::array<Float, NO> call(const X& x)
+	{
+		std::copy(x.cbegin(), x.cbegin() + NI, in.begin());
+		std::array<Float, NO> out;
+		const auto snapshot = store.get();
+		snapshot.weights().forward(in.data(), 1, out.data(), scratch);
+		return out;
+	}
+
+	// n rows of NI inputs to n rows of NO outputs, all on the same
+	// snapshot; returns its version
+	std::uint64_t call_batch(const Float* x, std::size_t n, Float* out)
+	{
+		const auto snapshot = store.get();
+		snapshot.weights().forward(x, n, out, scratch);
+		return snapshot.version();
+	}
+
+	// Of the latest snapshot
+	std::uint64_t version() const
+	{
+		return store.get().version();
+	}
+
+private:
+	const WeightStore& store;
+	std::array<Float, NI> in;
+	std::vector<Float> scratch;
+};
+
+// How far acting lagged behind learning during a pipelined run.
+// Staleness of a tick is the number of earlier ticks whose transitions
+// were not yet learned from when its actions were chosen (0 for run()).
+struct PipelineStats
+{
+	std::size_t ticks = 0;
+	double mean_staleness = 0;
+	std::size_t max_staleness = 0;
+	double sim_wait = 0;   // seconds the simulation waited for a free slot
+	double learn_wait = 0; // seconds the learner waited for a tick
+	double seconds = 0;
+};
+
+#endif
@@ -2,214 +2,643 @@
 #define __POLYGON_POLYGON_H
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <string>
 
+#include "alloc.h"
+#include "trace.h"
 #include "cacla.h"
+#include "pipeline.h"
+#include "telemetry.h"
 #include "track.h"
+#include "trackpool.h"
+#include "trajectory.h"
+#include "workers.h"
+#include "world.h"
 
-constexpr Range TRANGE = Range{-1, 1};
-
-Float normalize(const Range& from, Float x, const Range& to)
+// Learner hyperparameters and world count of a Polygon.
+struct PolygonConfig
 {
-	return to.lo + (x - from.lo) * (to.hi - to.lo) / (from.hi - from.lo);
-}
+	std::size_t hidden = 18;
+	double gamma = 0.99;
+	double alpha = 0.1;
+	double beta = 0.001;
+	double sigma = 0.1;
+	std::size_t nworlds = 10;
+	unsigned seed = time(0);
+	// >0: run() overlaps acting and learning, with up to this many ticks
+	// waiting for the learner besides the one it trains on
+	std::size_t pipeline_depth = 0;
+	double dt = 0.1; // simulated seconds per action
+	bool shared_arena = false; // all cars on the first track, bumping into each other
+	// one learner update per tick for all worlds, pipelined or not
+	bool batch_learning = false;
+	EpisodeLimits episode;
+	bool random_starts = true; // episodes start anywhere along the way
+	// >0: batched updates compute their gradients on this many threads, in
+	// shards of learn_shard rows (ApproxMLP only, see ShardedGrad); the
+	// weights then don't depend on the thread count. Needs batch_learning,
+	// as per-transition updates have nothing to split.
+	unsigned learn_threads = 0;
+	std::size_t learn_shard = 32;
+	// physics steps every sampled action is held for: the actor, V and
+	// the updates run once per action_repeat calls of Car::act()
+	unsigned action_repeat = 1;
+};
 
-template <std::size_t N>
-struct MinMax
+// Layout: where the cars' rays look, see sensors.h
+template <std::size_t NRAYS, std::size_t NA,
+	template <std::size_t, std::size_t> class Approximator = ApproxTiny,
+	typename Layout = UniformRays>
+struct Polygon
 {
-	std::array<Range, N> ranges;
+	std::vector<World<NRAYS, NA, Layout>> worlds;
+	std::shared_ptr<const TrackPool> tracks;
 
-	template <typename T>
-	MinMax(const T& aranges)
+	double last_reward = 0;
+	Cacla<NRAYS, NA, Approximator> learner;
+	MinMax<NRAYS> minmax;
+	Range reward_range = {-100, 100};
+	unsigned stopped_cycles = 0; // episodes that ended stuck
+	unsigned wander_cycles = 0;  // episodes that ended the wrong way round
+	unsigned epoch = 0;          // episodes ended for any reason
+	int laps = 0;                // by ended episodes, see World::laps()
+
+	std::string ws_dir;
+	unsigned current_index = 0;
+	PolygonConfig config;
+	std::size_t next_track = 0;
+	std::unique_ptr<Recorder<NRAYS, NA>> recorder;
+	PipelineStats pipeline_stats; // of the last run_pipelined()
+	std::unique_ptr<CarArena> arena; // with config.shared_arena
+	std::unique_ptr<WorkerPool> learn_pool; // with config.learn_threads
+	double spawn_at = 0; // arc length of the next spot tried by spawn()
+	TelemetryData telemetry = TelemetryData(); // as of the last run()
+	std::unique_ptr<TelemetryWriter> telemetry_writer;
+	std::array<double, TELEMETRY_NPHASES> phase_seconds{}; // since the last run()
+	std::chrono::steady_clock::time_point telemetry_since =
+		std::chrono::steady_clock::now();
+	// V and Ac as of the last run(), for readers on other threads (the
+	// heatmap reads them through WeightReaders)
+	WeightStore value_weights;
+	WeightStore policy_weights;
+
+	struct PipelineTransition
 	{
-		std::copy(aranges.cbegin(), aranges.cbegin() + N, ranges.begin());
-	}
+		std::array<Float, NRAYS> s, new_s;
+		std::array<Float, NA> action;
+		double reward;
+		unsigned steps;
+	};
 
-	template <typename C1, typename C2>
-	void norm(const C1& c1, C2& c2) const
+	struct PipelineTick
+	{
+		explicit PipelineTick(std::size_t nworlds) : transitions(nworlds) {}
+
+		std::vector<PipelineTransition> transitions;
+	};
+
+	// Network input of every world, row after row: the states at the
+	// start of a tick, and the ones World::recalc_state() writes into
+	// while the worlds act. Between ticks worlds write into `inputs`.
+	std::vector<std::array<Float, NRAYS>> inputs;
+	std::vector<std::array<Float, NRAYS>> next_inputs;
+	static_assert(sizeof(std::array<Float, NRAYS>) == NRAYS * sizeof(Float),
+		"input rows have to be contiguous");
+	// of run_batched(), row after row like the inputs
+	std::vector<Float> batch_mu, batch_actions, batch_rewards;
+	std::vector<unsigned> batch_steps;
+
+	// One sampled action held for config.action_repeat physics steps, or
+	// until the episode ends
+	struct HeldAction
 	{
-		// TODO: use std::transform
-		/*
-		const auto& rit = ranges.begin();
-		const auto& it1 = c1.cbegin();
-		auto& it2 = c2.begin();
-		for(; it1 != c1.cend();) {
-			*(c2++) = normalize(*(rit++), (*c1++), TRANGE);			
+		double reward = 0;       // raw, mean of the steps
+		double learn_reward = 0; // sum of the normalized ones, discounted
+		unsigned steps = 0;
+	};
+	std::vector<HeldAction> held_actions; // last of every world, for the recorder
+
+	Polygon(std::string dir, const PolygonConfig& aconfig = PolygonConfig())
+		: Polygon(dir, aconfig, mk_tracks())
+	{}
+
+	// Worlds are spread round-robin over the tracks of the pool. The pool
+	// is only read, so several polygons (e.g. the trials of a sweep) may
+	// share it.
+	Polygon(std::string dir, const PolygonConfig& aconfig,
+		std::shared_ptr<const TrackPool> atracks)
+		: ws_dir(dir), config(aconfig),
+			tracks(atracks),
+			minmax(mk_state_ranges()),
+			learner(mk_state_ranges(),
+				aconfig.hidden,
+				aconfig.gamma,
+				aconfig.alpha,
+				aconfig.beta,
+				aconfig.sigma,
+				aconfig.seed
+			),
+			value_weights(learner.V.weights()),
+			policy_weights(learner.Ac.weights())
+	{
+		worlds.reserve(config.nworlds);
+		if(config.shared_arena) {
+			arena.reset(new CarArena(config.nworlds));
+			for(auto i = 0; i < config.nworlds; i++) {
+				worlds.emplace_back((*tracks)[0]);
+				spawn(i);
+			}
+			// now that all cars are in place
+			for(auto& world: worlds) {
+				world.limits = config.episode;
+				world.place(world.car.center, world.car.course);
+			}
+		} else {
+			for(; next_track < config.nworlds; next_track++) {
+				worlds.emplace_back((*tracks)[next_track]);
+				worlds.back().limits = config.episode;
+				random_restart(next_track);
+			}
+		}
+		inputs.resize(worlds.size());
+		next_inputs.resize(worlds.size());
+		held_actions.resize(worlds.size());
+		for(auto j = 0; j < worlds.size(); j++) {
+			worlds[j].bind_input(inputs[j].data(), minmax);
+		}
+		if(config.learn_threads > 0) {
+			if(!config.batch_learning) {
+				throw std::runtime_error("learn_threads needs batch_learning");
+			}
+			learn_pool.reset(new WorkerPool(config.learn_threads));
+			learner.V.use_workers(learn_pool.get(), config.learn_shard);
+			learner.Ac.use_workers(learn_pool.get(), config.learn_shard);
 		}
-		*/
-		std::transform(ranges.cbegin(), ranges.cend(),
-			c1.cbegin(), c2.begin(),
-			[](const Range& r, Float x)
-			{
-				return normalize(r, x, TRANGE);
-			});
 	}
-};
 
-template <std::size_t NRAYS, std::size_t NA>
-struct World {
-	Car<NRAYS> car;
-	std::shared_ptr<Figure> walls;
-	std::shared_ptr<Way> way;
-	WayPoint way_point;
-	WayPoint old_way_point;
-	std::array<Float, NRAYS> state;
-	std::array<Float, NA> last_action;
-
-	World(std::shared_ptr<Figure> awalls, std::shared_ptr<Way> away)
-		: walls(awalls), way(away),
-		  car({-110, 0}, {0, 1}, awalls),
-		  way_point(way->where_is(car.center))
+	// Starts world `index` over on the next track of the pool, or at the
+	// next free spot of a shared arena
+	void reset_world(std::size_t index)
 	{
-		state.fill(0);
-		last_action.fill(0);
+		auto& world = worlds[index];
+		if(arena) {
+			world.set_track((*tracks)[0]);
+			if(config.random_starts) {
+				spawn_at = random_start(*world.track->way, config.seed, index,
+					world.episode);
+			}
+			spawn(index);
+			return;
+		}
+		world.set_track((*tracks)[next_track++]);
+		random_restart(index);
 	}
 
-	template <typename A>
-	void act(const A& action)
+	// Restarts the worlds whose episodes ended on the last tick, in place:
+	// the cars, tracks and buffers of the worlds are all reused
+	void end_episodes()
 	{
-		car.act(action);
-		old_way_point = way_point;
-		way_point = way->where_is(car.center);
-		recalc_state();
-		std::copy(action.begin(), action.end(), last_action.begin());
+		for(auto i = 0; i < worlds.size(); i++) {
+			const auto ending = worlds[i].ending;
+			if(ending == Ending::none) {
+				continue;
+			}
+			epoch++;
+			stopped_cycles += ending == Ending::stuck;
+			wander_cycles += ending == Ending::wrong_way;
+			laps += worlds[i].laps();
+			reset_world(i);
+		}
 	}
 
-	double reward() const
+	// The episode of world `index` starts over at a random spot of its
+	// way, with config.random_starts
+	void random_restart(std::size_t index)
 	{
-		auto speed_reward = car.speed;
-		if(car.speed < 0) {
-			speed_reward = -car.speed/2.0;
+		auto& world = worlds[index];
+		if(config.random_starts) {
+			world.restart_at(random_start(*world.track->way, config.seed,
+				index, world.episode));
 		}
+	}
 
-		auto dist_reward = 0.0;
-		for(const auto& s: state) {
-			auto k = s*(1 - 0.0099*s);
-			if(k < dist_reward)
-				dist_reward = k;
+	// Puts world `index` at the first spot along the way from spawn_at on
+	// where its car keeps clear of the walls and the other cars, trying
+	// the middle of the way and a lane to either side
+	void spawn(std::size_t index)
+	{
+		auto& world = worlds[index];
+		auto& car = world.car;
+		const auto& way = *world.track->way;
+		const auto step = car.length + 1.0;
+		const auto lane = car.width + 0.4;
+		const auto margin = 0.3;
+		const auto self = car.arena ? car.arena_id : ~std::uint32_t(0);
+		for(auto k = 0; k * step < way.length(); k++) {
+			Pt center, course;
+			way.pose_at(spawn_at, center, course);
+			spawn_at += step;
+			for(auto side: {0.0, 1.0, -1.0}) {
+				car.set_pos(center + side * lane * course.rperp(), course);
+				if(within(car.path, *world.track->grid, margin)
+					|| arena->within(self, car.body(), margin)) {
+					continue;
+				}
+				if(!car.arena) {
+					car.join(*arena);
+				}
+				world.place(car.center, car.course);
+				return;
+			}
 		}
+		throw std::runtime_error("no room for another car on the arena track");
+	}
 
-		auto wheels_reward = -car.wheels_angle*car.wheels_angle;
+	// Logs every tick of every world to path from now on
+	void record_to(const std::string& path)
+	{
+		recorder.reset(new Recorder<NRAYS, NA>(path, *tracks, worlds.size()));
+	}
 
-		auto action_penalty = car.action_penalty3(last_action);
-		auto action_reward = -action_penalty*action_penalty;
+	// Publishes the metrics of every run() from now on to the shared
+	// memory segment `name`, for a monitor process to read
+	void publish_to(const std::string& name)
+	{
+		telemetry_writer.reset(new TelemetryWriter(name));
+		telemetry_since = std::chrono::steady_clock::now();
+	}
+
+	// TODO: save, load
 
-		auto speed_penalty = -car.speed*car.speed;		
+	double run(unsigned ncycles)
+	{
+		if(config.pipeline_depth > 0) {
+			return run_pipelined(ncycles);
+		}
+		if(config.batch_learning) {
+			return run_batched(ncycles);
+		}
+		TRACE_SCOPE("Polygon::run");
+		auto N = worlds.size();
+		auto sum_reward = 0.0;
+		auto all_reward = 0.0;
+		// phases are only timed for a monitor, and on world 0
+		auto* phases = telemetry_writer ? phase_seconds.data() : nullptr;
+		for(auto i = 0; i < ncycles; i++) {
+			const auto r = run_once_for_world(0, phases);
+			sum_reward += r;
+			all_reward += r;
+			for(auto j = 1; j < N; j++) {
+				all_reward += run_once_for_world(j);
+			}
+			if(recorder) {
+				ALLOC_PHASE(record);
+				std::chrono::steady_clock::time_point t0;
+				if(phases) {
+					t0 = clock_now();
+				}
+				recorder->record(worlds, held_actions);
+				if(phases) {
+					phases[3] += seconds_since(t0) / N;
+				}
+			}
+			end_episodes();
+			next_tick();
+		}
+		publish_weights(ncycles);
+		update_telemetry(ncycles, all_reward);
+		return sum_reward;
+	}
 
-		return 10.0*speed_reward
-			+ 20.0*dist_reward
-			+ 5.0*wheels_reward
-			+ action_reward
-			+ 10.0*speed_penalty;
+	void publish_weights(unsigned ncycles)
+	{
+		const auto ticks = telemetry.ticks + ncycles;
+		value_weights.publish([this](MLPWeights& w) { learner.V.weights(w); },
+			ticks);
+		policy_weights.publish([this](MLPWeights& w) { learner.Ac.weights(w); },
+			ticks);
 	}
 
-	void recalc_state()
+	// Times the policy/act/learn phases into phases[0..2] when given
+	double run_once_for_world(unsigned index, double* phases = nullptr)
 	{
-		// TODO: USE std::transform()
-		/*
-		const auto& isx = cars.isxs.cbegin();
-		auto& st = state.begin();
+		auto& world = worlds[index];
+		const auto& s = inputs[index];
+		const auto& new_s = next_inputs[index];
+		world.input = next_inputs[index].data();
+		std::chrono::steady_clock::time_point t0;
+		if(phases) {
+			t0 = clock_now();
+		}
 
-		for(; isx != cars.isx.cend(); isx++, st++) {
-			*st = (isx->dist < 10) ? isx->dist : 10;
+		std::array<Float, NA> a;
+		{
+			ALLOC_PHASE(policy);
+			TRACE_SCOPE("Cacla::get_action");
+			a = learner.get_action(s);
 		}
-		*/
-		std::transform(car.isxs.cbegin(), car.isxs.cend(),
-			state.begin(),
-			[](const auto& isx) {
-				return (isx.dist < 10) ? isx.dist : 10;
-			}
-		);
+		if(phases) {
+			phases[0] += lap(t0);
+		}
+		HeldAction held;
+		{
+			ALLOC_PHASE(act);
+			held = act_held(world, a);
+		}
+		check_input(world);
+		if(phases) {
+			phases[1] += lap(t0);
+		}
+
+		{
+			ALLOC_PHASE(learn);
+			learner.step(s, new_s, a, held.learn_reward, held.steps);
+		}
+		if(phases) {
+			phases[2] += lap(t0);
+		}
+		last_reward = held.reward;
+		world.last_reward = held.reward;
+		held_actions[index] = held;
+		return held.reward;
 	}
 
-	constexpr std::size_t nrays() const noexcept
+	template <typename A>
+	HeldAction act_held(World<NRAYS, NA, Layout>& world, const A& a)
 	{
-		return NRAYS;
+		HeldAction res;
+		auto sum = 0.0;
+		auto discount = 1.0;
+		do {
+			world.act(a, config.dt);
+			const auto r = world.reward();
+			sum += r;
+			res.learn_reward += discount * normalize(reward_range, r, TRANGE);
+			discount *= learner.state.gamma;
+			res.steps++;
+		} while(res.steps < config.action_repeat && !world.done());
+		res.reward = sum / res.steps;
+		return res;
 	}
-};
 
-template <std::size_t NRAYS, std::size_t NA>
-struct Polygon
-{
-	std::vector<World<NRAYS, NA>> worlds;
-	std::shared_ptr<Figure> walls;
+	// The states the worlds reached on this tick are the inputs of the
+	// next one
+	void next_tick()
+	{
+		std::swap(inputs, next_inputs);
+		for(auto j = 0; j < worlds.size(); j++) {
+			worlds[j].input = inputs[j].data();
+		}
+	}
 
-	double last_reward = 0;
-	Cacla<NRAYS, NA> learner;
-	MinMax<NRAYS> minmax;
-	Range reward_range = {-100, 100};
-	unsigned stopped_cycles = 0;
-	unsigned wander_cycles = 0;
-	unsigned epoch = 0;
+	// Refreshes `telemetry` after a run of ncycles ticks and publishes it
+	// when a monitor segment is open. Rates cover the wall time since the
+	// previous run (rendering included); the weight scan happens here
+	// rather than every frame.
+	void update_telemetry(unsigned ncycles, double all_reward)
+	{
+		const auto N = worlds.size();
+		const auto steps = double(ncycles) * N;
+		const auto dt = seconds_since(telemetry_since);
+		telemetry_since = clock_now();
+
+		auto& d = telemetry;
+		d.ticks += ncycles;
+		d.nworlds = N;
+		d.running = 1;
+		d.steps_per_sec = dt > 0 ? steps / dt : 0;
+		d.avg_reward = steps > 0 ? all_reward / steps : 0;
+		d.sigma = learner.state.sigma;
+
+		auto& td = learner.td_stats;
+		d.td_count = td.count;
+		d.td_mean = td.count > 0 ? td.sum / td.count : 0;
+		d.td_rms = td.count > 0 ? std::sqrt(td.sum_sq / td.count) : 0;
+		d.td_max = td.max_abs;
+		d.actor_updates = td.count > 0 ? double(td.actor_updates) / td.count : 0;
+		td = TdStats();
+
+		d.max_w_v = learner.V.max_q();
+		d.max_w_ac = learner.Ac.max_q();
+
+		for(auto i = 0; i < TELEMETRY_NPHASES; i++) {
+			d.phase_us[i] = ncycles > 0 ? 1e6 * phase_seconds[i] / ncycles : 0;
+		}
+		phase_seconds.fill(0);
+		if(config.pipeline_depth > 0) {
+			d.staleness = pipeline_stats.mean_staleness;
+			d.sim_wait = pipeline_stats.sim_wait;
+			d.learn_wait = pipeline_stats.learn_wait;
+		}
 
-	std::string ws_dir;
-	unsigned current_index = 0;
+		if(telemetry_writer) {
+			telemetry_writer->publish(d);
+		}
+	}
 
-	Polygon(std::string dir)
-		: ws_dir(dir),
-			minmax(mk_state_ranges()),
-			learner(mk_state_ranges(),
-				18,    // hidden 
-				0.99,  // gamma
-				0.1,   // alpha
-				0.001, // beta
-				0.1   // sigma
-			)
+	static std::chrono::steady_clock::time_point clock_now()
 	{
-		auto scale = 10.0;
-		walls = std::make_shared<Figure>(clover(4.0, scale));
-		auto way = std::make_shared<Way>(clover_data, scale);
-		auto world = World<NRAYS, NA>(walls, way);
-		worlds = std::vector<World<NRAYS, NA>>(10, world);
+		return std::chrono::steady_clock::now();
 	}
 
-	// TODO: save, load
+	static double seconds_since(std::chrono::steady_clock::time_point t0)
+	{
+		return std::chrono::duration<double>(clock_now() - t0).count();
+	}
 
-	double run(unsigned ncycles)
+	// Seconds since t0, and restarts t0
+	static double lap(std::chrono::steady_clock::time_point& t0)
 	{
-		std::array<Float, NRAYS> s, new_s;
-		auto N = worlds.size();
+		const auto t1 = clock_now();
+		const auto dt = std::chrono::duration<double>(t1 - t0).count();
+		t0 = t1;
+		return dt;
+	}
+
+	// Like run(), but all worlds act on a tick before the learner trains
+	// on their transitions in one Cacla::step_batch(). Every world acts
+	// with the policy as of the end of the previous tick, evaluated for
+	// all of them in one batch straight from the input rows.
+	double run_batched(unsigned ncycles)
+	{
+		TRACE_SCOPE("Polygon::run");
+		const auto N = worlds.size();
+		batch_mu.resize(N * NA);
+		batch_actions.resize(N * NA);
+		batch_rewards.resize(N);
+		batch_steps.resize(N);
 		auto sum_reward = 0.0;
-		for(auto i = 0; i < ncycles; i++) {
-			sum_reward += run_once_for_world(0, s, new_s);
-			for(auto j = 1; j < N; j++) {
-				run_once_for_world(j, s, new_s);
+		auto all_reward = 0.0;
+		for(auto t = 0; t < ncycles; t++) {
+			{
+				ALLOC_PHASE(policy);
+				learner.Ac.call_batch(inputs[0].data(), N, batch_mu.data());
+			}
+			for(auto j = 0; j < N; j++) {
+				auto& world = worlds[j];
+				world.input = next_inputs[j].data();
+				std::array<Float, NA> a;
+				{
+					ALLOC_PHASE(policy);
+					std::copy(batch_mu.cbegin() + j * NA,
+						batch_mu.cbegin() + (j + 1) * NA, a.begin());
+					a = learner.sample_action(a);
+					std::copy(a.cbegin(), a.cend(), batch_actions.begin() + j * NA);
+				}
+				HeldAction held;
+				{
+					ALLOC_PHASE(act);
+					held = act_held(world, a);
+				}
+				check_input(world);
+				batch_rewards[j] = held.learn_reward;
+				batch_steps[j] = held.steps;
+				held_actions[j] = held;
+				const auto r = held.reward;
+				world.last_reward = r;
+				all_reward += r;
+				if(j == 0) {
+					sum_reward += r;
+					last_reward = r;
+				}
 			}
+			{
+				ALLOC_PHASE(learn);
+				learner.step_batch(inputs[0].data(), next_inputs[0].data(),
+					batch_actions.data(), batch_rewards.data(), N,
+					batch_steps.data());
+			}
+			if(recorder) {
+				ALLOC_PHASE(record);
+				recorder->record(worlds, held_actions);
+			}
+			end_episodes();
+			next_tick();
 		}
+		publish_weights(ncycles);
+		update_telemetry(ncycles, all_reward);
 		return sum_reward;
 	}
 
-	template <typename T1, typename T2>
-	double run_once_for_world(unsigned index, T1& s, T2& new_s)
+	// Like run(), but tick t+1 is simulated while the learner trains on
+	// tick t on another thread. The worlds act with a snapshot of the
+	// actor's weights taken after the last tick the learner finished;
+	// up to config.pipeline_depth ticks can wait for the learner before
+	// the simulation blocks. The learner swaps the tick it trains on out
+	// of the ring first, so even depth 1 simulates during learning.
+	// Per-world order within a tick is lost: all worlds of a tick act
+	// with the same policy. With config.batch_learning the learner trains
+	// on a tick in one Cacla::step_batch(). See pipeline_stats.
+	double run_pipelined(unsigned ncycles)
 	{
-		auto& world = worlds[index];
-
-		minmax.norm(world.state, s);
-		auto a = learner.get_action(s);
-		world.act(a);
-		auto r = world.reward();
+		const auto N = worlds.size();
+		HandoffRing<PipelineTick> ring(config.pipeline_depth, PipelineTick(N));
+		WeightStore policy(learner.Ac.weights());
+
+		typedef std::chrono::steady_clock clock;
+		auto seconds = [](clock::time_point a, clock::time_point b) {
+			return std::chrono::duration<double>(b - a).count();
+		};
+		const auto start = clock::now();
+		auto learn_wait = 0.0;
+		std::thread learn([&]() {
+			Tracer::instance().thread_name("learner");
+			PipelineTick learning(N);
+			for(auto t = 0;; t++) {
+				const auto t0 = clock::now();
+				auto* tick = ring.acquire_read();
+				learn_wait += seconds(t0, clock::now());
+				if(!tick) {
+					break;
+				}
+				// the slot gets the buffers of the previous tick back
+				std::swap(learning.transitions, tick->transitions);
+				ring.commit_read();
+				TRACE_SCOPE("learn tick");
+				if(config.batch_learning) {
+					learner.step_batch(learning.transitions);
+				} else {
+					for(const auto& tr: learning.transitions) {
+						learner.step(tr.s, tr.new_s, tr.action, tr.reward, tr.steps);
+					}
+				}
+				policy.publish([this](MLPWeights& w) { learner.Ac.weights(w); }, t + 1);
+			}
+		});
 
-		minmax.norm(world.state, new_s);
-		for(auto x: new_s) {
-			if(x > 0.9 || x < -0.9) {
-				std::cout << "new_s[.]: " << x << "\n";
-				throw "normalized value out of range";
+		PipelineStats stats;
+		std::vector<Float> scratch;
+		std::array<Float, NA> mu;
+		auto sum_reward = 0.0;
+		auto all_reward = 0.0;
+		auto sum_staleness = 0.0;
+		try {
+			for(auto t = 0; t < ncycles; t++) {
+				TRACE_SCOPE("sim tick");
+				const auto t0 = clock::now();
+				auto& tick = ring.acquire_write();
+				stats.sim_wait += seconds(t0, clock::now());
+
+				const auto snapshot = policy.get();
+				const auto staleness = t - snapshot.ticks();
+				sum_staleness += staleness;
+				stats.max_staleness = std::max(stats.max_staleness, staleness);
+				for(auto j = 0; j < N; j++) {
+					auto& world = worlds[j];
+					auto& tr = tick.transitions[j];
+					tr.s = inputs[j];
+					world.input = next_inputs[j].data();
+					snapshot.weights().forward(tr.s.data(), 1, mu.data(), scratch);
+					tr.action = learner.sample_action(mu);
+					const auto held = act_held(world, tr.action);
+					const auto r = held.reward;
+					check_input(world);
+					tr.new_s = next_inputs[j];
+					tr.reward = held.learn_reward;
+					tr.steps = held.steps;
+					held_actions[j] = held;
+					world.last_reward = r;
+					all_reward += r;
+					if(j == 0) {
+						sum_reward += r;
+						last_reward = r;
+					}
+				}
+				ring.commit_write();
+				if(recorder) {
+					recorder->record(worlds, held_actions);
+				}
+				end_episodes();
+				next_tick();
 			}
+		} catch(...) {
+			ring.close();
+			learn.join();
+			throw;
 		}
-
-		learner.step(s, new_s, a, normalize(reward_range, r, TRANGE));
-		last_reward = r;
-		return r;		
+		ring.close();
+		learn.join();
+
+		stats.ticks = ncycles;
+		stats.mean_staleness = ncycles > 0 ? sum_staleness / ncycles : 0;
+		stats.learn_wait = learn_wait;
+		stats.seconds = seconds(start, clock::now());
+		pipeline_stats = stats;
+		publish_weights(ncycles);
+		update_telemetry(ncycles, all_reward);
+		return sum_reward;
 	}
 
-	const World<NRAYS, NA>& current_world() const
+	const World<NRAYS, NA, Layout>& current_world() const
 	{ 
 		return worlds[current_index];
 	}
 
-	const World<NRAYS, NA>& get_world(std::size_t index) const
+	const World<NRAYS, NA, Layout>& get_world(std::size_t index) const
 	{
 		return worlds[index];
 	}
@@ -219,13 +648,49 @@ struct Polygon
 		return worlds.size();
 	}
 
-	// TODO: v_fn, ac_fn	
+	// Value and greedy action of the learner for a world's current state
+	double v_fn(const World<NRAYS, NA, Layout>& world) const
+	{
+		std::array<Float, NRAYS> s;
+		minmax.norm(world.state, s);
+		return learner.v_fn(s);
+	}
+
+	std::array<Float, NA> ac_fn(const World<NRAYS, NA, Layout>& world) const
+	{
+		std::array<Float, NRAYS> s;
+		minmax.norm(world.state, s);
+		return learner.ac_fn(s);
+	}
+
+	// check_state() for the input row a world just wrote, by its peak
+	static void check_input(const World<NRAYS, NA, Layout>& world)
+	{
+		if(world.input_peak > 0.9) {
+			std::cout << "new_s[.]: " << world.input_peak << "\n";
+			throw "normalized value out of range";
+		}
+	}
+
+	template <typename T>
+	static void check_state(const T& new_s)
+	{
+		for(auto x: new_s) {
+			if(x > 0.9 || x < -0.9) {
+				std::cout << "new_s[.]: " << x << "\n";
+				throw "normalized value out of range";
+			}
+		}
+	}
+
+	static std::shared_ptr<const TrackPool> mk_tracks()
+	{
+		return std::make_shared<TrackPool>(Track::clover());
+	}
 
 	static std::array<Range, NRAYS> mk_state_ranges()
 	{
-		std::array<Range, NRAYS> state_ranges;
-		state_ranges.fill({-5, 20});
-		return state_ranges; 
+		return state_ranges<NRAYS>();
 	}
 };
 
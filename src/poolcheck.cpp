@@ -0,0 +1,161 @@
+// Stress check of WorkerPool: many short jobs of shrinking and growing
+// task counts on pools with more threads than tasks, the pattern of
+// minibatch gradients and their reductions. Fails if any task of a job
+// runs other than exactly once, or if a job doesn't finish within a few
+// seconds (a worker stuck in a job that was already over). Then checks
+// that ShardedGrad gives bit-identical gradients on any number of
+// threads, also more than there are shards.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mlp.h"
+#include "shardgrad.h"
+#include "workers.h"
+
+void usage()
+{
+	std::cerr << "usage: poolcheck [--jobs N]\n";
+}
+
+// Number of failures running njobs jobs on a pool of nthreads
+unsigned stress(unsigned nthreads, bool pinned, unsigned njobs)
+{
+	WorkerPool pool(nthreads, pinned);
+	const std::size_t sizes[] = {64, 2, 1, 3, 0, 17, 1, 2};
+	std::vector<std::atomic<unsigned>> runs(64);
+	auto failures = 0u;
+	for(auto j = 0; j < njobs; j++) {
+		const auto n = sizes[j % (sizeof(sizes) / sizeof(sizes[0]))];
+		for(auto& r: runs) {
+			r = 0;
+		}
+		std::atomic<bool> out_of_range{false};
+		pool.run(n, [&](std::size_t i) {
+			if(i >= n) {
+				out_of_range = true;
+				return;
+			}
+			runs[i]++;
+		});
+		for(auto i = 0; i < runs.size(); i++) {
+			if(runs[i] != (i < n ? 1 : 0)) {
+				out_of_range = true;
+			}
+		}
+
+		// every thread once, then a reduction in the fixed order
+		std::vector<std::atomic<unsigned>> each_runs(pool.size());
+		pool.each([&](std::size_t t) { each_runs[t]++; });
+		for(auto& r: each_runs) {
+			if(r != 1) {
+				out_of_range = true;
+			}
+		}
+		std::vector<std::size_t> items(n + 1);
+		for(auto i = 0; i < items.size(); i++) {
+			items[i] = i;
+		}
+		pool.reduce(items.size(), [&](std::size_t a, std::size_t b) {
+			items[a] += items[b];
+			items[b] = 0;
+		});
+		if(items[0] != n * (n + 1) / 2) {
+			out_of_range = true;
+		}
+		if(out_of_range) {
+			failures++;
+		}
+		// a gap between jobs, for workers that wake up late to find the
+		// last one over
+		if(j % 3 == 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+	return failures;
+}
+
+// Number of minibatches whose gradient on a pool of nthreads differs in
+// any bit from the one computed on a single thread
+unsigned grad_mismatches(unsigned nthreads, unsigned nbatches)
+{
+	std::mt19937 gen(1);
+	const auto net = MLPWeights::xavier({36, 18, 2}, gen);
+	std::uniform_real_distribution<Float> u(-1.0, 1.0);
+	WorkerPool one(1), many(nthreads);
+	ShardedGrad ref_grad(8), grad(8);
+	auto mismatches = 0u;
+	for(auto b = 0; b < nbatches; b++) {
+		// 1 to 40 rows: 1 to 5 shards, fewer than the threads
+		const auto n = 1 + b % 40;
+		std::vector<Float> in(n * net.n_in()), targets(n * net.n_out());
+		for(auto& x: in) {
+			x = u(gen);
+		}
+		for(auto& x: targets) {
+			x = u(gen);
+		}
+		const auto& ref = ref_grad.compute(one, net, targets.data(), in.data(), n, 1.0);
+		const auto& g = grad.compute(many, net, targets.data(), in.data(), n, 1.0);
+		if(g.w != ref.w || g.b != ref.b) {
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned njobs = 20000;
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if(arg == "--jobs" && i + 1 < argc) {
+			njobs = std::atoi(argv[++i]);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	std::atomic<bool> finished{false};
+	std::thread watchdog([&]() {
+		const auto limit = std::chrono::steady_clock::now()
+			+ std::chrono::seconds(60 + njobs / 1000);
+		while(!finished && std::chrono::steady_clock::now() < limit) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		if(!finished) {
+			std::cout << "FAIL: a job never finished" << std::endl;
+			std::_Exit(1);
+		}
+	});
+
+	auto failures = 0u;
+	for(auto nthreads: {2u, 3u, 8u, 16u}) {
+		for(auto pinned: {false, true}) {
+			const auto f = stress(nthreads, pinned, njobs);
+			std::cout << nthreads << (pinned ? " pinned" : "") << " threads, "
+					  << njobs << " jobs: " << f << " failed\n";
+			failures += f;
+		}
+	}
+	for(auto nthreads: {2u, 7u, 16u}) {
+		const auto m = grad_mismatches(nthreads, njobs / 10);
+		std::cout << "ShardedGrad on " << nthreads << " threads, "
+				  << njobs / 10 << " minibatches: " << m << " differ\n";
+		failures += m;
+	}
+	finished = true;
+	watchdog.join();
+	if(failures > 0) {
+		std::cout << "FAIL\n";
+		return 1;
+	}
+	std::cout << "ok\n";
+}
@@ -0,0 +1,88 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geom.h"
+#include "cacla.h"
+#include "polygon.h"
+#include "offline.h"
+
+void usage()
+{
+	std::cerr << "usage: pretrain LOG... [--epochs N] [--batch N] [--shard N]\n"
+			  << "                [--threads N] [--seed N] [--alpha A] [--gamma G]\n"
+			  << "                [--hidden N] [--init FILE] [--out FILE]\n";
+}
+
+int main(int argc, char** argv)
+{
+	OfflineConfig config;
+	PolygonConfig pconfig;
+	auto epochs = 10;
+	std::string init, out = "pretrained.bin";
+	std::vector<std::string> logs;
+
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto has_value = i + 1 < argc;
+		if(arg == "--epochs" && has_value) {
+			epochs = std::atoi(argv[++i]);
+		} else if(arg == "--batch" && has_value) {
+			config.batch = std::atoi(argv[++i]);
+		} else if(arg == "--shard" && has_value) {
+			config.shard = std::atoi(argv[++i]);
+		} else if(arg == "--threads" && has_value) {
+			config.nthreads = std::atoi(argv[++i]);
+		} else if(arg == "--seed" && has_value) {
+			config.seed = pconfig.seed = std::atoi(argv[++i]);
+		} else if(arg == "--alpha" && has_value) {
+			config.alpha = std::atof(argv[++i]);
+		} else if(arg == "--gamma" && has_value) {
+			config.gamma = std::atof(argv[++i]);
+		} else if(arg == "--hidden" && has_value) {
+			pconfig.hidden = std::atoi(argv[++i]);
+		} else if(arg == "--init" && has_value) {
+			init = argv[++i];
+		} else if(arg == "--out" && has_value) {
+			out = argv[++i];
+		} else if(arg.compare(0, 2, "--") != 0) {
+			logs.emplace_back(arg);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if(logs.empty()) {
+		usage();
+		return 1;
+	}
+
+	// fresh (or loaded) networks shaped like the ones Polygon trains
+	const auto ranges = Polygon<36, 2>::mk_state_ranges();
+	Cacla<36, 2> learner(ranges, pconfig.hidden, config.gamma,
+		pconfig.alpha, pconfig.beta, pconfig.sigma, pconfig.seed);
+	if(!init.empty()) {
+		learner.load(init);
+	}
+
+	OfflineTrainer<36, 2> trainer(config, MinMax<36>(ranges),
+		learner.V.weights(), learner.Ac.weights());
+	for(const auto& log: logs) {
+		std::cout << log << ": " << trainer.add_log(log) << " transitions\n";
+	}
+
+	for(auto e = 0; e < epochs; e++) {
+		const auto stats = trainer.train_epoch();
+		std::cout << "epoch " << e
+				  << "  td^2 " << stats.critic_loss
+				  << "  actor " << stats.actor_share
+				  << "  " << stats.samples / stats.seconds << " samples/s\n";
+	}
+
+	learner.V.set_weights(trainer.v_weights());
+	learner.Ac.set_weights(trainer.ac_weights());
+	learner.save(out);
+	std::cout << "saved " << out << "\n";
+}
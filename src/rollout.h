@@ -0,0 +1,94 @@
+#ifndef __POLYGON_ROLLOUT_H
+#define __POLYGON_ROLLOUT_H
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "trace.h"
+#include "workers.h"
+#include "world.h"
+
+// Many short simulations forked from one WorldState in parallel, e.g. to
+// pick an action by looking ahead or to evaluate a policy from a given
+// spot. Every thread of the pool keeps a scratch World of its own and
+// load()s the start state into it for each of its rollouts, so a
+// rollout copies a WorldState and nothing else: no allocation once every
+// thread has made its world.
+template <std::size_t NRAYS, std::size_t NA, typename Layout = UniformRays>
+class Rollouts
+{
+public:
+	Rollouts(unsigned nthreads = 1, double adt = 0.1, double agamma = 0.99,
+		const EpisodeLimits& alimits = EpisodeLimits())
+		: dt(adt), gamma(agamma), limits(alimits),
+		  minmax(state_ranges<NRAYS>()),
+		  workers(nthreads),
+		  scratch(workers.size())
+	{}
+
+	std::size_t nthreads() const
+	{
+		return workers.size();
+	}
+
+	// Rollouts 0..n-1 from `from` on track, each for horizon steps or
+	// until its episode ends (see EpisodeLimits; `from` counts the steps
+	// so far). returns[r] gets the discounted sum of the rewards of
+	// rollout r. policy(r, step, input, action) fills the action from the
+	// normalized input row; it is called from all the threads at once.
+	// Rollouts are split between the threads in fixed shares.
+	template <typename Policy>
+	void run(const std::shared_ptr<const Track>& track, const WorldState<NA>& from,
+		std::size_t n, unsigned horizon, Policy&& policy, double* returns)
+	{
+		TRACE_SCOPE("Rollouts::run");
+		workers.each([&](std::size_t t) {
+			auto& s = scratch[t];
+			if(!s.world) {
+				s.world.reset(new World<NRAYS, NA, Layout>(track));
+				s.world->bind_input(s.input.data(), minmax);
+			} else if(s.world->track != track) {
+				s.world->set_track(track);
+			}
+			s.world->limits = limits;
+			const auto end = n * (t + 1) / workers.size();
+			for(auto r = n * t / workers.size(); r < end; r++) {
+				returns[r] = roll(*s.world, s.input, r, from, horizon, policy);
+			}
+		});
+	}
+
+private:
+	struct Scratch
+	{
+		std::unique_ptr<World<NRAYS, NA, Layout>> world;
+		std::array<Float, NRAYS> input;
+	};
+
+	template <typename Policy>
+	double roll(World<NRAYS, NA, Layout>& world, const std::array<Float, NRAYS>& input,
+		std::size_t r, const WorldState<NA>& from, unsigned horizon, Policy& policy) const
+	{
+		world.load(from);
+		std::array<Float, NA> action;
+		auto res = 0.0;
+		auto discount = 1.0;
+		for(auto step = 0u; step < horizon && !world.done(); step++) {
+			policy(r, step, input.data(), action);
+			world.act(action, dt);
+			res += discount * world.reward();
+			discount *= gamma;
+		}
+		return res;
+	}
+
+	double dt;
+	double gamma;
+	EpisodeLimits limits;
+	MinMax<NRAYS> minmax;
+	WorkerPool workers;
+	std::vector<Scratch> scratch; // of every thread
+};
+
+#endif
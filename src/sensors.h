@@ -0,0 +1,221 @@
+#ifndef __POLYGON_SENSORS_H
+#define __POLYGON_SENSORS_H
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#include "geom.h"
+
+// Sensor layouts: where the rays of a Car look and how far. A layout is
+// a type with
+//
+//   static constexpr double angle(i, n)  of ray i out of n, in radians
+//                                        counterclockwise from the course
+//   static constexpr double range(i, n)  how far ray i sees from the car
+//                                        body, 0 for no limit
+//   static constexpr std::size_t size    n it is made for, 0 for any
+//
+// and Car/World/Polygon take it as a template parameter. The directions
+// are tabulated at compile time (RayDirs), so placing the rays costs a
+// rotation per ray and no sin/cos. Rays that see less far also walk
+// fewer grid cells when sensing.
+
+// sin/cos usable in constant expressions: x reduced to [-pi, pi], then
+// Taylor series to double precision
+constexpr double cx_reduce(double x)
+{
+	const auto k = static_cast<long long>(x / (2 * M_PI)
+		+ (x >= 0 ? 0.5 : -0.5));
+	return x - k * (2 * M_PI);
+}
+
+constexpr double cx_sin(double x)
+{
+	x = cx_reduce(x);
+	auto term = x, sum = x;
+	for(auto k = 1; k < 20; k++) {
+		term *= -x * x / ((2 * k) * (2 * k + 1));
+		sum += term;
+	}
+	return sum;
+}
+
+constexpr double cx_cos(double x)
+{
+	x = cx_reduce(x);
+	auto term = 1.0, sum = 1.0;
+	for(auto k = 1; k < 20; k++) {
+		term *= -x * x / ((2 * k - 1) * (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+constexpr double deg(double d)
+{
+	return d * M_PI / 180.0;
+}
+
+// NRAYS rays spread evenly round the car, the first one straight ahead
+struct UniformRays
+{
+	static constexpr std::size_t size = 0;
+
+	static constexpr double angle(std::size_t i, std::size_t n)
+	{
+		return 2.0 * M_PI * i / n;
+	}
+
+	static constexpr double range(std::size_t, std::size_t)
+	{
+		return 0.0;
+	}
+};
+
+// Half of the rays (one more for odd counts) over the FrontDeg degrees
+// ahead, edges included, and the others evenly over the rest of the
+// circle, seeing RearRange at most (0: no limit). A ray points at the
+// middle of the front sector only when it has an odd number of rays,
+// e.g. n = 5 or 6 but not n = 3 (rays at -45 and 45 degrees). The
+// sector is centered OffsetDeg to the left of the course; anything but
+// 0 makes the layout asymmetric, e.g. towards the inside of a track
+// driven one way round.
+template <int FrontDeg = 90, int RearRange = 0, int OffsetDeg = 0>
+struct ForwardRays
+{
+	static_assert(FrontDeg > 0 && FrontDeg < 360, "front sector out of range");
+
+	static constexpr std::size_t size = 0;
+
+	static constexpr std::size_t front(std::size_t n)
+	{
+		return (n + 1) / 2;
+	}
+
+	static constexpr double angle(std::size_t i, std::size_t n)
+	{
+		const auto nf = front(n);
+		const auto f = double(FrontDeg);
+		if(i < nf) {
+			return deg(OffsetDeg + (nf > 1 ? -0.5 * f + f * i / (nf - 1) : 0.0));
+		}
+		const auto nr = n - nf;
+		return deg(OffsetDeg + 0.5 * f + (360.0 - f) * (i - nf + 1) / (nr + 1));
+	}
+
+	static constexpr double range(std::size_t i, std::size_t n)
+	{
+		return i < front(n) ? 0.0 : RearRange;
+	}
+};
+
+// Rays at the given angles, in degrees counterclockwise from the course.
+// AngleRays<...>::Ranges<...> gives each one a range of its own, e.g.
+// AngleRays<-45, 0, 45, 180>::Ranges<0, 0, 0, 5> for a short rear ray.
+template <int... Deg>
+struct AngleRays
+{
+	static constexpr std::size_t size = sizeof...(Deg);
+
+	static constexpr double angle(std::size_t i, std::size_t)
+	{
+		const int degs[] = {Deg...};
+		return deg(degs[i]);
+	}
+
+	static constexpr double range(std::size_t, std::size_t)
+	{
+		return 0.0;
+	}
+
+	// Ray i sees Range[i] at most, 0 for no limit
+	template <int... Range>
+	struct Ranges
+	{
+		static_assert(sizeof...(Range) == sizeof...(Deg), "one range per angle");
+
+		static constexpr std::size_t size = sizeof...(Deg);
+
+		static constexpr double angle(std::size_t i, std::size_t n)
+		{
+			return AngleRays::angle(i, n);
+		}
+
+		static constexpr double range(std::size_t i, std::size_t)
+		{
+			const int ranges[] = {Range...};
+			return ranges[i];
+		}
+	};
+};
+
+// Direction of a ray as the rotation of the course, and its range
+struct RayDir
+{
+	double c, s;
+	double range;
+};
+
+template <std::size_t N>
+struct RayTable
+{
+	RayDir dirs[N];
+
+	constexpr const RayDir& operator[](std::size_t i) const
+	{
+		return dirs[i];
+	}
+
+	// Whether any ray has a limited range
+	constexpr bool limited() const
+	{
+		for(auto i = 0; i < N; i++) {
+			if(dirs[i].range > 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+template <typename Layout, std::size_t N, std::size_t... I>
+constexpr RayTable<N> make_ray_table(std::index_sequence<I...>)
+{
+	return RayTable<N>{{RayDir{cx_cos(Layout::angle(I, N)),
+		cx_sin(Layout::angle(I, N)), Layout::range(I, N)}...}};
+}
+
+// The table of a layout for N rays, built by the compiler
+template <typename Layout, std::size_t N>
+struct RayDirs
+{
+	static_assert(Layout::size == 0 || Layout::size == N,
+		"the layout is made for another number of rays");
+
+	static constexpr RayTable<N> table =
+		make_ray_table<Layout, N>(std::make_index_sequence<N>());
+	static constexpr bool limited = table.limited();
+};
+
+template <typename Layout, std::size_t N>
+constexpr RayTable<N> RayDirs<Layout, N>::table;
+
+template <typename Layout, std::size_t N>
+constexpr bool RayDirs<Layout, N>::limited;
+
+// Rays (p0 = center, p1 = unit direction) of a car at center heading
+// along course
+template <typename Layout, typename Rays>
+void place_rays(Rays& rays, const Pt& center, const Pt& course)
+{
+	const auto& table = RayDirs<Layout, std::tuple_size<Rays>::value>::table;
+	for(auto i = 0; i < rays.size(); i++) {
+		const auto& d = table[i];
+		rays[i] = Sect(center, Pt(d.c * course.x - d.s * course.y,
+			d.s * course.x + d.c * course.y));
+	}
+}
+
+#endif
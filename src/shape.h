@@ -1,69 +1,151 @@
 #ifndef __POLYGON_SHAPE_H
 #define __POLYGON_SHAPE_H
 
+#include <vector>
+
 #include <SFML/Graphics.hpp>
 
 #include "geom.h"
+#include "car.h"
+#include "heatmap.h"
 
-class PathShape: public sf::Drawable
+// Static figure (e.g. the walls of a track), baked into a vertex array
+// once and drawn with a single call afterwards. Changes made to the
+// figure after construction are not picked up.
+class FigureShape: public sf::Drawable
 {
 public:
-	PathShape(const Path& p, const sf::Color& c = sf::Color::Black)
-		: m_path(p), m_color(c)
-	{}
+	FigureShape(const Figure& f, const sf::Color color = sf::Color::Black)
+		: m_vertices(sf::Lines)
+	{
+		for(const auto& p: f.paths) {
+			for(const auto& s: p.sects) {
+				m_vertices.append(sf::Vertex(sf::Vector2f(s.p0.x, s.p0.y), color));
+				m_vertices.append(sf::Vertex(sf::Vector2f(s.p1.x, s.p1.y), color));
+			}
+		}
+	}
 
 	void draw(sf::RenderTarget &target, sf::RenderStates states) const override
 	{
-		sf::VertexArray vs(sf::LinesStrip);
-		for(const auto& s: m_path.sects) {
-			sf::Vertex v(sf::Vector2f(s.p0.x, s.p0.y), m_color);
-			vs.append(v);
-		}
-		const auto p = m_path.sects.back().p1;
-		vs.append(sf::Vertex(sf::Vector2f(p.x, p.y), m_color));
-		target.draw(vs);
+		target.draw(m_vertices, states);
 	}
 
 private:
-	const Path& m_path;
-	sf::Color m_color;
+	sf::VertexArray m_vertices;
 };
 
-
-class FigureShape: public sf::Drawable
+// All cars in one vertex array: 4 lines (8 vertices) per car, rewritten
+// in place by update() and drawn with a single call.
+template <std::size_t NRAYS, typename Layout = UniformRays>
+class CarsShape: public sf::Drawable
 {
 public:
-	FigureShape(const Figure& f, const sf::Color color = sf::Color::Black)
-		: m_figure(f), m_color(color)
+	CarsShape()
+		: m_vertices(sf::Lines)
 	{}
 
-	void draw(sf::RenderTarget &target, sf::RenderStates states) const override
+	void add(const Car<NRAYS, Layout>& car, const sf::Color& color)
+	{
+		m_cars.emplace_back(&car);
+		m_colors.emplace_back(color);
+		m_vertices.resize(8 * m_cars.size());
+	}
+
+	void update()
+	{
+		update([](std::size_t) { return true; });
+	}
+
+	// Cars for which visible(index) is false are drawn transparent
+	template <typename F>
+	void update(F&& visible)
 	{
-		for(const auto& p: m_figure.paths) {
-			PathShape(p, m_color).draw(target, states);
+		for(auto i = 0; i < m_cars.size(); i++) {
+			const auto& car = *m_cars[i];
+			const auto l = 0.5 * car.length * car.course;
+			const auto w = 0.5 * car.course.rperp() * car.width;
+			const Pt corners[4] = {car.center + l - w,
+								   car.center + l + w,
+								   car.center - l + w,
+								   car.center - l - w};
+			const auto color = visible(i) ? m_colors[i] : sf::Color::Transparent;
+			auto* v = &m_vertices[8 * i];
+			for(auto k = 0; k < 4; k++) {
+				const auto& p0 = corners[k];
+				const auto& p1 = corners[(k + 1) % 4];
+				v[2*k].position = sf::Vector2f(p0.x, p0.y);
+				v[2*k].color = color;
+				v[2*k + 1].position = sf::Vector2f(p1.x, p1.y);
+				v[2*k + 1].color = color;
+			}
 		}
 	}
+
+	void draw(sf::RenderTarget& target, sf::RenderStates states) const override
+	{
+		target.draw(m_vertices, states);
+	}
+
 private:
-	const Figure& m_figure;
-	sf::Color m_color;
+	std::vector<const Car<NRAYS, Layout>*> m_cars;
+	std::vector<sf::Color> m_colors;
+	sf::VertexArray m_vertices;
 };
 
-template <std::size_t NRAYS>
-class CarShape: public sf::Drawable
+// Heatmap as one quad per cell, in one vertex array. update() recolors
+// it from the current heatmap values of one channel: 0 is V, 1..NA are
+// the actions. Blue is the lowest value, red the highest.
+template <std::size_t NRAYS, std::size_t NA, typename Layout = UniformRays>
+class HeatmapShape: public sf::Drawable
 {
 public:
-	CarShape(const Car<NRAYS>& car, const sf::Color& color)
-		: m_car(car), m_color(color)
-	{}
+	explicit HeatmapShape(const Heatmap<NRAYS, NA, Layout>& heatmap)
+		: m_heatmap(heatmap),
+		  m_vertices(sf::Quads, 4 * heatmap.ncells())
+	{
+		const auto h = 0.5 * heatmap.cell;
+		const Pt corners[4] = {Pt(-h, -h), Pt(h, -h), Pt(h, h), Pt(-h, h)};
+		for(auto i = 0; i < heatmap.ncells(); i++) {
+			const auto c = heatmap.center(i);
+			for(auto k = 0; k < 4; k++) {
+				const auto p = c + corners[k];
+				m_vertices[4 * i + k].position = sf::Vector2f(p.x, p.y);
+			}
+		}
+	}
+
+	void update(std::size_t channel)
+	{
+		auto value = [this, channel](std::size_t i) {
+			return channel == 0 ? m_heatmap.value(i)
+				: m_heatmap.action(i, channel - 1);
+		};
+		const auto n = m_heatmap.ncells();
+		auto lo = 1.0e20, hi = -1.0e20;
+		for(auto i = 0; i < n; i++) {
+			lo = std::min(lo, value(i));
+			hi = std::max(hi, value(i));
+		}
+		const auto range = (hi > lo) ? hi - lo : 1.0;
+		for(auto i = 0; i < n; i++) {
+			const auto t = (value(i) - lo) / range;
+			const auto color = sf::Color(static_cast<sf::Uint8>(255 * t), 0,
+				static_cast<sf::Uint8>(255 * (1 - t)), 160);
+			for(auto k = 0; k < 4; k++) {
+				m_vertices[4 * i + k].color = color;
+			}
+		}
+	}
 
 	void draw(sf::RenderTarget& target, sf::RenderStates states) const override
 	{
-		FigureShape(m_car.path, m_color).draw(target, states);
+		target.draw(m_vertices, states);
 	}
 
 private:
-	const Car<NRAYS>& m_car;
-	sf::Color m_color;
+	const Heatmap<NRAYS, NA, Layout>& m_heatmap;
+	sf::VertexArray m_vertices;
 };
 
 #endif
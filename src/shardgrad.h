@@ -0,0 +1,69 @@
+#ifndef __POLYGON_SHARDGRAD_H
+#define __POLYGON_SHARDGRAD_H
+
+#include <algorithm>
+#include <vector>
+
+#include "mlp.h"
+#include "workers.h"
+
+// Gradient of a minibatch computed data-parallel: the rows are cut into
+// shards of a fixed size, the workers of a pool backprop one shard each
+// into its own MLPGrad, and the shards are then summed pairwise in shard
+// order (WorkerPool::reduce). The sum thus depends on the shard size but
+// not on the number of threads, nor on which thread took which shard.
+//
+// Shard buffers are kept between calls and only grow, up to the largest
+// minibatch seen, so steady training doesn't allocate.
+class ShardedGrad
+{
+public:
+	explicit ShardedGrad(std::size_t ashard = 32)
+		: shard(std::max<std::size_t>(ashard, 1))
+	{}
+
+	std::size_t shard_size() const
+	{
+		return shard;
+	}
+
+	// Sum of weight * the gradient of every row of in against the same row
+	// of targets (see mlp_backprop); n > 0. Always called with nets of
+	// the same shape.
+	const MLPGrad& compute(WorkerPool& pool, const MLPWeights& net,
+		const Float* targets, const Float* in, std::size_t n, Float weight)
+	{
+		const auto ni = net.n_in();
+		const auto no = net.n_out();
+		const auto nshards = (n + shard - 1) / shard;
+		for(auto k = shards.size(); k < nshards; k++) {
+			shards.emplace_back();
+			shards.back().g.reset(net);
+		}
+
+		pool.run(nshards, [&](std::size_t k) {
+			auto& s = shards[k];
+			s.g.zero();
+			const auto end = std::min(n, (k + 1) * shard);
+			for(auto r = k * shard; r < end; r++) {
+				mlp_backprop(net, in + r * ni, targets + r * no, weight, s.g, s.scratch);
+			}
+		});
+		pool.reduce(nshards, [&](std::size_t i, std::size_t j) {
+			shards[i].g.add(shards[j].g);
+		});
+		return shards[0].g;
+	}
+
+private:
+	struct Shard
+	{
+		MLPGrad g;
+		std::vector<Float> scratch;
+	};
+
+	std::size_t shard;
+	std::vector<Shard> shards;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "geom.h"
+#include "track.h"
+#include "car.h"
+#include "cacla.h"
+#include "polygon.h"
+#include "sweep.h"
+
+void usage()
+{
+	std::cerr << "usage: sweep [--grid | --random N] [--cycles N] [--eta N]\n"
+			  << "             [--threads N] [--seed N] [--csv FILE]\n"
+			  << "             [--track FILE]...\n";
+}
+
+int main(int argc, char** argv)
+{
+	auto random_trials = 0;
+	unsigned cycles = 1000;
+	unsigned eta = 3;
+	unsigned threads = std::thread::hardware_concurrency();
+	unsigned seed = 1;
+	std::string csv;
+	auto tracks = std::make_shared<TrackPool>();
+
+	for(auto i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const auto has_value = i + 1 < argc;
+		if(arg == "--grid") {
+			random_trials = 0;
+		} else if(arg == "--random" && has_value) {
+			random_trials = std::atoi(argv[++i]);
+		} else if(arg == "--cycles" && has_value) {
+			cycles = std::atoi(argv[++i]);
+		} else if(arg == "--eta" && has_value) {
+			eta = std::atoi(argv[++i]);
+		} else if(arg == "--threads" && has_value) {
+			threads = std::atoi(argv[++i]);
+		} else if(arg == "--seed" && has_value) {
+			seed = std::atoi(argv[++i]);
+		} else if(arg == "--csv" && has_value) {
+			csv = argv[++i];
+		} else if(arg == "--track" && has_value) {
+			tracks->load(argv[++i]);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	PolygonConfig base;
+	base.seed = seed;
+	SweepSpace space;
+	auto configs = random_trials > 0
+		? space.sample(base, random_trials, seed)
+		: space.grid(base);
+
+	if(tracks->empty()) {
+		tracks->add(Track::clover());
+	}
+	Sweep<36, 2> sweep(tracks, cycles, eta, threads);
+	auto results = sweep.run(configs);
+
+	print_sweep_table(std::cout, results);
+	if(!csv.empty()) {
+		std::ofstream ofs(csv);
+		write_sweep_csv(ofs, results);
+	}
+}
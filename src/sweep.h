@@ -0,0 +1,273 @@
+#ifndef __POLYGON_SWEEP_H
+#define __POLYGON_SWEEP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "polygon.h"
+
+// Values tried for every hyperparameter of a PolygonConfig.
+// grid() takes the cartesian product, sample() draws from the
+// [min, max] span of each list (log-uniformly for the learning rates).
+struct SweepSpace
+{
+	std::vector<std::size_t> hidden = {12, 18, 24};
+	std::vector<double> gamma = {0.95, 0.99};
+	std::vector<double> alpha = {0.01, 0.1};
+	std::vector<double> beta = {0.0001, 0.001};
+	std::vector<double> sigma = {0.1, 0.3};
+
+	std::vector<PolygonConfig> grid(const PolygonConfig& base) const
+	{
+		std::vector<PolygonConfig> configs;
+		for(auto h: hidden) {
+			for(auto g: gamma) {
+				for(auto a: alpha) {
+					for(auto b: beta) {
+						for(auto s: sigma) {
+							auto config = base;
+							config.hidden = h;
+							config.gamma = g;
+							config.alpha = a;
+							config.beta = b;
+							config.sigma = s;
+							config.seed = base.seed + configs.size();
+							configs.emplace_back(config);
+						}
+					}
+				}
+			}
+		}
+		return configs;
+	}
+
+	std::vector<PolygonConfig> sample(const PolygonConfig& base,
+		std::size_t n, unsigned seed) const
+	{
+		std::mt19937 gen(seed);
+		auto uniform = [&gen](double lo, double hi) {
+			return std::uniform_real_distribution<double>(lo, hi)(gen);
+		};
+		auto log_uniform = [&uniform](double lo, double hi) {
+			return std::exp(uniform(std::log(lo), std::log(hi)));
+		};
+
+		const auto h = std::minmax_element(hidden.cbegin(), hidden.cend());
+		const auto g = std::minmax_element(gamma.cbegin(), gamma.cend());
+		const auto a = std::minmax_element(alpha.cbegin(), alpha.cend());
+		const auto b = std::minmax_element(beta.cbegin(), beta.cend());
+		const auto s = std::minmax_element(sigma.cbegin(), sigma.cend());
+
+		std::vector<PolygonConfig> configs;
+		for(auto i = 0; i < n; i++) {
+			auto config = base;
+			config.hidden = std::uniform_int_distribution<std::size_t>(
+				*h.first, *h.second)(gen);
+			config.gamma = uniform(*g.first, *g.second);
+			config.alpha = log_uniform(*a.first, *a.second);
+			config.beta = log_uniform(*b.first, *b.second);
+			config.sigma = uniform(*s.first, *s.second);
+			config.seed = base.seed + i;
+			configs.emplace_back(config);
+		}
+		return configs;
+	}
+};
+
+struct SweepResult
+{
+	std::size_t id = 0;
+	PolygonConfig config;
+	unsigned cycles = 0;   // cycles trained in total
+	unsigned rung = 0;     // last rung the trial took part in
+	double score = 0;      // mean reward of world 0 over the last rung
+	bool failed = false;
+	std::string error;
+};
+
+// Successive halving over independent Polygon learners.
+//
+// Every rung trains each surviving trial for rung_cycles more cycles
+// (concurrently, one trial per thread at a time), scores it by its mean
+// reward over those cycles and keeps the best 1/eta of them. rung_cycles
+// is multiplied by eta after every rung. All trials share one track pool.
+template <std::size_t NRAYS, std::size_t NA>
+class Sweep
+{
+public:
+	Sweep(std::shared_ptr<const TrackPool> atracks,
+		unsigned amin_cycles = 1000, unsigned aeta = 3,
+		unsigned anthreads = std::thread::hardware_concurrency())
+		: tracks(atracks),
+		  min_cycles(amin_cycles), eta(std::max(aeta, 2u)),
+		  nthreads(std::max(anthreads, 1u))
+	{}
+
+	std::vector<SweepResult> run(const std::vector<PolygonConfig>& configs,
+		std::ostream& log = std::cerr)
+	{
+		std::vector<Trial> trials;
+		for(auto i = 0; i < configs.size(); i++) {
+			Trial trial;
+			trial.result.id = i;
+			trial.result.config = configs[i];
+			trial.polygon.reset(new Polygon<NRAYS, NA>(
+				"sweep", configs[i], tracks));
+			trials.emplace_back(std::move(trial));
+		}
+
+		std::vector<std::size_t> alive(trials.size());
+		for(auto i = 0; i < alive.size(); i++) {
+			alive[i] = i;
+		}
+
+		auto rung_cycles = min_cycles;
+		for(unsigned rung = 0; !alive.empty(); rung++) {
+			log << "rung " << rung << ": " << alive.size()
+				<< " trials x " << rung_cycles << " cycles\n";
+			run_rung(trials, alive, rung, rung_cycles);
+
+			alive.erase(std::remove_if(alive.begin(), alive.end(),
+				[&trials](std::size_t i) {
+					return trials[i].result.failed;
+				}), alive.end());
+			std::sort(alive.begin(), alive.end(),
+				[&trials](std::size_t i, std::size_t j) {
+					return trials[i].result.score > trials[j].result.score;
+				});
+			if(alive.size() <= 1) {
+				break;
+			}
+			const auto keep = std::max<std::size_t>(alive.size() / eta, 1);
+			for(auto k = keep; k < alive.size(); k++) {
+				trials[alive[k]].polygon.reset();
+			}
+			alive.resize(keep);
+			rung_cycles *= eta;
+		}
+
+		std::vector<SweepResult> results;
+		for(const auto& t: trials) {
+			results.emplace_back(t.result);
+		}
+		std::sort(results.begin(), results.end(),
+			[](const SweepResult& r1, const SweepResult& r2) {
+				if(r1.failed != r2.failed) {
+					return r2.failed;
+				}
+				if(r1.rung != r2.rung) {
+					return r1.rung > r2.rung;
+				}
+				return r1.score > r2.score;
+			});
+		return results;
+	}
+
+private:
+	struct Trial
+	{
+		std::unique_ptr<Polygon<NRAYS, NA>> polygon;
+		SweepResult result;
+	};
+
+	void run_rung(std::vector<Trial>& trials,
+		const std::vector<std::size_t>& alive,
+		unsigned rung, unsigned ncycles)
+	{
+		std::atomic<std::size_t> next(0);
+		auto worker = [&]() {
+			for(auto k = next++; k < alive.size(); k = next++) {
+				auto& trial = trials[alive[k]];
+				trial.result.rung = rung;
+				try {
+					auto sum = trial.polygon->run(ncycles);
+					trial.result.score = sum / ncycles;
+					trial.result.cycles += ncycles;
+					if(!std::isfinite(trial.result.score)) {
+						trial.result.failed = true;
+						trial.result.error = "non-finite reward";
+					}
+				} catch(const char* e) {
+					trial.result.failed = true;
+					trial.result.error = e;
+				} catch(const std::exception& e) {
+					trial.result.failed = true;
+					trial.result.error = e.what();
+				}
+				if(trial.result.failed) {
+					trial.polygon.reset();
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		const auto n = std::min<std::size_t>(nthreads, alive.size());
+		for(auto i = 0; i < n; i++) {
+			threads.emplace_back(worker);
+		}
+		for(auto& t: threads) {
+			t.join();
+		}
+	}
+
+	std::shared_ptr<const TrackPool> tracks;
+	unsigned min_cycles;
+	unsigned eta;
+	unsigned nthreads;
+};
+
+void print_sweep_table(std::ostream& os,
+	const std::vector<SweepResult>& results)
+{
+	os << std::setw(4) << "id"
+	   << std::setw(8) << "hidden"
+	   << std::setw(8) << "gamma"
+	   << std::setw(10) << "alpha"
+	   << std::setw(10) << "beta"
+	   << std::setw(8) << "sigma"
+	   << std::setw(10) << "cycles"
+	   << std::setw(6) << "rung"
+	   << std::setw(12) << "score"
+	   << "  status\n";
+	for(const auto& r: results) {
+		os << std::setw(4) << r.id
+		   << std::setw(8) << r.config.hidden
+		   << std::setw(8) << r.config.gamma
+		   << std::setw(10) << r.config.alpha
+		   << std::setw(10) << r.config.beta
+		   << std::setw(8) << r.config.sigma
+		   << std::setw(10) << r.cycles
+		   << std::setw(6) << r.rung
+		   << std::setw(12) << r.score
+		   << "  " << (r.failed ? r.error : "ok") << "\n";
+	}
+}
+
+void write_sweep_csv(std::ostream& os,
+	const std::vector<SweepResult>& results)
+{
+	os << "id,hidden,gamma,alpha,beta,sigma,seed,cycles,rung,score,failed\n";
+	for(const auto& r: results) {
+		os << r.id << ","
+		   << r.config.hidden << ","
+		   << r.config.gamma << ","
+		   << r.config.alpha << ","
+		   << r.config.beta << ","
+		   << r.config.sigma << ","
+		   << r.config.seed << ","
+		   << r.cycles << ","
+		   << r.rung << ","
+		   << r.score << ","
+		   << r.failed << "\n";
+	}
+}
+
+#endif
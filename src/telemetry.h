@@ -0,0 +1,189 @@
+#ifndef __POLYGON_TELEMETRY_H
+#define __POLYGON_TELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Training metrics in a POSIX shared memory segment, for monitors in
+// other processes (see monitor.cpp).
+//
+// The segment has a fixed layout: a header, a sequence counter and one
+// TelemetryData. The trainer overwrites the data under a seqlock. The
+// counter is odd while a write is in progress, and readers retry until
+// they copy the data between two equal, even reads of it. Readers never
+// write to the segment, so they cost the trainer nothing.
+
+constexpr char TELEMETRY_MAGIC[8] = {'P', 'L', 'G', 'T', 'E', 'L', 'E', 'M'};
+constexpr std::uint32_t TELEMETRY_VERSION = 1;
+constexpr const char* TELEMETRY_DEFAULT_NAME = "/polygon-telemetry";
+
+constexpr std::size_t TELEMETRY_NPHASES = 4;
+constexpr const char* TELEMETRY_PHASE_NAMES[TELEMETRY_NPHASES] =
+	{"policy", "act", "learn", "record"};
+
+// Everything is averaged over the ticks since the previous publication
+struct TelemetryData
+{
+	std::uint64_t ticks;          // since the trainer started
+	std::uint32_t nworlds;
+	std::uint32_t running;        // 0 once the trainer has exited
+	double steps_per_sec;         // world steps/s
+	double avg_reward;            // per world and tick
+	double sigma;                 // exploration noise
+	double td_mean;
+	double td_rms;
+	double td_max;                // largest |TD error|
+	std::uint64_t td_count;
+	double actor_updates;         // Ac updates per step
+	double max_w_v;               // largest |weight| of V
+	double max_w_ac;              // largest |weight| of Ac
+	double phase_us[TELEMETRY_NPHASES]; // per world step, serial runs only
+	double staleness;             // pipelined runs only
+	double sim_wait;              // s, pipelined runs only
+	double learn_wait;            // s, pipelined runs only
+};
+
+struct TelemetrySegment
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t size;           // sizeof(TelemetrySegment)
+	std::atomic<std::uint64_t> seq;
+	TelemetryData data;
+};
+
+static_assert(sizeof(std::atomic<std::uint64_t>) == 8,
+	"the sequence counter has to live in the segment itself");
+
+// Shared memory object names start with a slash
+inline std::string telemetry_shm_name(const std::string& name)
+{
+	return !name.empty() && name[0] == '/' ? name : "/" + name;
+}
+
+class TelemetryWriter
+{
+public:
+	explicit TelemetryWriter(const std::string& aname = TELEMETRY_DEFAULT_NAME)
+		: name(telemetry_shm_name(aname))
+	{
+		const auto fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+		if(fd < 0) {
+			throw std::runtime_error("can't create telemetry segment " + name);
+		}
+		if(ftruncate(fd, sizeof(TelemetrySegment)) != 0) {
+			close(fd);
+			throw std::runtime_error("can't size telemetry segment " + name);
+		}
+		auto addr = mmap(nullptr, sizeof(TelemetrySegment),
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if(addr == MAP_FAILED) {
+			throw std::runtime_error("can't map telemetry segment " + name);
+		}
+		seg = static_cast<TelemetrySegment*>(addr);
+		seg->seq.store(0, std::memory_order_relaxed);
+		std::memset(&seg->data, 0, sizeof(seg->data));
+		seg->version = TELEMETRY_VERSION;
+		seg->size = sizeof(TelemetrySegment);
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(seg->magic, TELEMETRY_MAGIC, sizeof(seg->magic));
+	}
+
+	~TelemetryWriter()
+	{
+		auto last = last_data;
+		last.running = 0;
+		publish(last);
+		munmap(seg, sizeof(TelemetrySegment));
+		shm_unlink(name.c_str());
+	}
+
+	TelemetryWriter(const TelemetryWriter&) = delete;
+	TelemetryWriter& operator=(const TelemetryWriter&) = delete;
+
+	// Only ever called from one thread
+	void publish(const TelemetryData& d)
+	{
+		const auto s = seg->seq.load(std::memory_order_relaxed);
+		seg->seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(&seg->data, &d, sizeof(d));
+		seg->seq.store(s + 2, std::memory_order_release);
+		last_data = d;
+	}
+
+private:
+	std::string name;
+	TelemetrySegment* seg = nullptr;
+	TelemetryData last_data = TelemetryData();
+};
+
+class TelemetryReader
+{
+public:
+	explicit TelemetryReader(const std::string& aname = TELEMETRY_DEFAULT_NAME)
+	{
+		const auto name = telemetry_shm_name(aname);
+		const auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if(fd < 0) {
+			throw std::runtime_error("no telemetry segment " + name);
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(TelemetrySegment)) {
+			close(fd);
+			throw std::runtime_error("bad telemetry segment " + name);
+		}
+		auto addr = mmap(nullptr, sizeof(TelemetrySegment), PROT_READ,
+			MAP_SHARED, fd, 0);
+		close(fd);
+		if(addr == MAP_FAILED) {
+			throw std::runtime_error("can't map telemetry segment " + name);
+		}
+		seg = static_cast<const TelemetrySegment*>(addr);
+		if(std::memcmp(seg->magic, TELEMETRY_MAGIC, sizeof(seg->magic)) != 0
+			|| seg->version != TELEMETRY_VERSION
+			|| seg->size != sizeof(TelemetrySegment)) {
+			munmap(const_cast<TelemetrySegment*>(seg), sizeof(TelemetrySegment));
+			throw std::runtime_error("bad telemetry segment " + name);
+		}
+	}
+
+	~TelemetryReader()
+	{
+		munmap(const_cast<TelemetrySegment*>(seg), sizeof(TelemetrySegment));
+	}
+
+	TelemetryReader(const TelemetryReader&) = delete;
+	TelemetryReader& operator=(const TelemetryReader&) = delete;
+
+	// A consistent copy of the data and the sequence number it had
+	std::uint64_t read(TelemetryData& d) const
+	{
+		for(;;) {
+			const auto s1 = seg->seq.load(std::memory_order_acquire);
+			if(s1 & 1) {
+				continue;
+			}
+			std::memcpy(&d, &seg->data, sizeof(d));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const auto s2 = seg->seq.load(std::memory_order_relaxed);
+			if(s1 == s2) {
+				return s1;
+			}
+		}
+	}
+
+private:
+	const TelemetrySegment* seg = nullptr;
+};
+
+#endif
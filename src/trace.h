@@ -0,0 +1,297 @@
+#ifndef __POLYGON_TRACE_H
+#define __POLYGON_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Timeline tracer with Chrome trace JSON output (chrome://tracing,
+// ui.perfetto.dev).
+//
+// TRACE_SCOPE("name") records the scope as one complete event when
+// tracing is on, and costs a relaxed atomic load when it is off.
+// POLYGON_NO_TRACE compiles the scopes out entirely. Names must be
+// string literals: only the pointer is stored.
+//
+// Every thread writes into a ring of its own, so recording takes no
+// lock; once a ring is full the oldest events are overwritten. A ring
+// is handed to the next new thread when its thread exits, so threads
+// started over and over (like the pipelined learner) share a row in
+// the timeline instead of adding one each time.
+//
+// On x86 timestamps are TSC ticks (a few ns to read, where the steady
+// clock can take tens); they are converted to time when the trace is
+// written, from a steady clock reading taken at start().
+
+struct TraceEvent
+{
+	const char* name;
+	std::uint64_t start; // Tracer::now() ticks
+	std::uint64_t dur;
+};
+
+class TraceBuffer
+{
+public:
+	TraceBuffer(std::size_t capacity, unsigned atid)
+		: events(capacity), tid(atid)
+	{}
+
+	// Only called by the thread that owns the buffer
+	void push(const char* name, std::uint64_t start, std::uint64_t dur)
+	{
+		const auto h = head.load(std::memory_order_relaxed);
+		events[h & (events.size() - 1)] = TraceEvent{name, start, dur};
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// Events still in the ring, oldest first. Events the owner overwrote
+	// while they were being copied are dropped.
+	std::vector<TraceEvent> snapshot() const
+	{
+		const auto cap = events.size();
+		const auto h = head.load(std::memory_order_acquire);
+		const auto first = h > cap ? h - cap : 0;
+		std::vector<TraceEvent> res;
+		res.reserve(h - first);
+		for(auto i = first; i < h; i++) {
+			res.emplace_back(events[i & (cap - 1)]);
+		}
+		const auto h2 = head.load(std::memory_order_acquire);
+		const auto valid = h2 > cap ? h2 - cap : 0;
+		if(valid > first) {
+			res.erase(res.begin(), res.begin() + std::min(valid - first, res.size()));
+		}
+		return res;
+	}
+
+	std::vector<TraceEvent> events;
+	std::atomic<std::uint64_t> head{0};
+	const unsigned tid;
+	std::atomic<const char*> thread_name{nullptr};
+	std::atomic<bool> in_use{false};
+};
+
+class Tracer
+{
+public:
+	static Tracer& instance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	static bool enabled()
+	{
+		return flag().load(std::memory_order_relaxed);
+	}
+
+	static std::uint64_t now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return steady_ns();
+#endif
+	}
+
+	// Events per thread, rounded up to a power of two. Only buffers
+	// created from now on get the new capacity.
+	void start(std::size_t capacity = 1 << 16)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto cap = std::size_t(1);
+		while(cap < capacity) {
+			cap *= 2;
+		}
+		buffer_capacity = cap;
+		if(epoch == 0) {
+			epoch = now();
+			epoch_ns = steady_ns();
+		}
+		flag().store(true, std::memory_order_relaxed);
+	}
+
+	void stop()
+	{
+		flag().store(false, std::memory_order_relaxed);
+	}
+
+	// The calling thread's buffer, taken on its first event
+	TraceBuffer& buffer()
+	{
+		thread_local Lease lease;
+		if(!lease.buf) {
+			lease.buf = acquire();
+		}
+		return *lease.buf;
+	}
+
+	// Labels the calling thread's row in the timeline; no-op (and no
+	// buffer taken) while tracing is off
+	void thread_name(const char* name)
+	{
+		if(enabled()) {
+			buffer().thread_name.store(name, std::memory_order_relaxed);
+		}
+	}
+
+	void write_json(std::ostream& os)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto elapsed = now() - epoch;
+		const auto elapsed_ns = steady_ns() - epoch_ns;
+		const auto ns_per_tick = elapsed > 0 && elapsed_ns > 0
+			? double(elapsed_ns) / elapsed : 1.0;
+		auto us = [ns_per_tick](std::uint64_t ticks) {
+			return std::to_string(ticks * ns_per_tick / 1000.0);
+		};
+		os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		auto sep = "\n";
+		for(const auto& b: buffers) {
+			if(const auto name = b->thread_name.load()) {
+				os << sep << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+				   << "\"tid\":" << b->tid << ",\"args\":{\"name\":\"";
+				write_escaped(os, name);
+				os << "\"}}";
+				sep = ",\n";
+			}
+			for(const auto& e: b->snapshot()) {
+				os << sep << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+				   << ",\"ts\":" << us(e.start - std::min(e.start, epoch))
+				   << ",\"dur\":" << us(e.dur) << ",\"name\":\"";
+				write_escaped(os, e.name);
+				os << "\"}";
+				sep = ",\n";
+			}
+		}
+		os << "\n]}\n";
+	}
+
+	void write_json(const std::string& path)
+	{
+		std::ofstream ofs(path);
+		write_json(ofs);
+		if(!ofs) {
+			throw std::runtime_error("can't write trace " + path);
+		}
+	}
+
+	// Writes the trace to path when the program exits normally
+	void dump_at_exit(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exit_path = path;
+	}
+
+	~Tracer()
+	{
+		if(!exit_path.empty()) {
+			try {
+				write_json(exit_path);
+			} catch(const std::exception&) {
+			}
+		}
+	}
+
+private:
+	struct Lease
+	{
+		TraceBuffer* buf = nullptr;
+
+		~Lease()
+		{
+			if(buf) {
+				buf->in_use.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	static std::atomic<bool>& flag()
+	{
+		static std::atomic<bool> on{false};
+		return on;
+	}
+
+	TraceBuffer* acquire()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(auto& b: buffers) {
+			auto expected = false;
+			if(b->in_use.compare_exchange_strong(expected, true)) {
+				return b.get();
+			}
+		}
+		buffers.emplace_back(new TraceBuffer(buffer_capacity, buffers.size() + 1));
+		buffers.back()->in_use = true;
+		return buffers.back().get();
+	}
+
+	static std::uint64_t steady_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static void write_escaped(std::ostream& os, const char* s)
+	{
+		for(; *s; s++) {
+			if(*s == '"' || *s == '\\') {
+				os << '\\';
+			}
+			os << *s;
+		}
+	}
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<TraceBuffer>> buffers;
+	std::size_t buffer_capacity = 1 << 16;
+	std::uint64_t epoch = 0;    // now() at the first start()
+	std::uint64_t epoch_ns = 0; // steady clock at the same moment
+	std::string exit_path;
+};
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* aname)
+		: name(Tracer::enabled() ? aname : nullptr)
+	{
+		if(name) {
+			start = Tracer::now();
+		}
+	}
+
+	~TraceScope()
+	{
+		if(name) {
+			Tracer::instance().buffer().push(name, start, Tracer::now() - start);
+		}
+	}
+
+private:
+	const char* name;
+	std::uint64_t start = 0;
+};
+
+#ifdef POLYGON_NO_TRACE
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
+
+#endif
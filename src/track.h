@@ -1,6 +1,7 @@
 #ifndef __POLYGON_TRACK_H
 #define __POLYGON_TRACK_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <random>
@@ -63,7 +64,8 @@ Float vec_prod_sign(const Pt& v1, const Pt& v2)
 }
 
 Figure make_track(const std::vector<Pt>& points0,
-	double d, double scale)
+	double d, double scale,
+	double jitter = 0.15, unsigned seed = std::mt19937::default_seed)
 {
 	auto n = points0.size();
 	auto points = std::vector<Pt>(points0.size());
@@ -72,8 +74,8 @@ Figure make_track(const std::vector<Pt>& points0,
 	}
 
 
-	std::mt19937 gen;
-	std::normal_distribution<Float> nd(0, 0.15 * scale);	
+	std::mt19937 gen(seed);
+	std::normal_distribution<Float> nd(0, jitter * scale);	
 
 
 	std::vector<Pt> ps1, ps2;
@@ -101,9 +103,10 @@ Figure make_track(const std::vector<Pt>& points0,
 	return Figure::compound({f1, f2});
 }
 
-Figure clover(Float d, Float scale)
+Figure clover(Float d, Float scale,
+	unsigned seed = std::mt19937::default_seed, double jitter = 0.15)
 {
-	return make_track(clover_data, d, scale);
+	return make_track(clover_data, d, scale, jitter, seed);
 }
 
 Figure obstacle(const Pt& p, double size)
@@ -115,7 +118,7 @@ Figure obstacle(const Pt& p, double size)
 		p + Pt(-d, -d),
 		p + Pt(-d, d)
 	};
-	Figure::closed_path(pts);
+	return Figure::closed_path(pts);
 }
 
 // WayPoint
@@ -154,11 +157,18 @@ Projection project(const Pt& a,
 }
 
 // Way
+//
+// A closed loop of segments, points[i] to points[i + 1] and the last
+// point back to the first. arc_start holds the arc length from points[0]
+// to the start of every segment, so a WayPoint maps to a position along
+// the loop (arc()) and distances between waypoints come in O(1).
 struct Way
 {
 	std::vector<double> segment_len;
+	std::vector<double> arc_start;
 	std::vector<Pt> points;
 	int count = 0;
+	double total_len = 0;
 
 	Way() {};
 
@@ -167,14 +177,18 @@ struct Way
 		for(const auto& p: points0) {
 			points.emplace_back(scale * p);
 		}
-		for(auto i = 0; i < points0.size(); i++) {
+		for(auto i = 0; i + 1 < points0.size(); i++) {
 			segment_len.emplace_back((points[i+1] - points[i]).norm());
 		}
 		segment_len.emplace_back((points.back() - points.front()).norm());
 		count = points0.size();
+		for(auto l: segment_len) {
+			arc_start.push_back(total_len);
+			total_len += l;
+		}
 	}
 
-	WayPoint where_is(const Pt& p)
+	WayPoint where_is(const Pt& p) const
 	{
 		auto min_pr = Projection{WayPoint(), 1.0e20};
 		for(auto i = 0; i < count; i++) {
@@ -188,20 +202,100 @@ struct Way
 		return min_pr.wp;
 	}
 
-	double offset(const WayPoint& old, const WayPoint& nw)
+	// Middle of the closing segment, facing points[0]
+	Pt start_center() const
+	{
+		return 0.5 * (points.back() + points.front());
+	}
+
+	Pt start_course() const
+	{
+		return normalized(points.front() - points.back());
+	}
+
+	double length() const
+	{
+		return total_len;
+	}
+
+	// Arc length of wp past points[0], in [0, length())
+	double arc(const WayPoint& wp) const
+	{
+		return arc_start[wp.segment] + wp.offset;
+	}
+
+	// Arc length of the start line, where start_center() is
+	double start_arc() const
+	{
+		return arc_start[count - 1] + 0.5 * segment_len[count - 1];
+	}
+
+	// a (any arc length) wrapped into [0, length())
+	double wrap(double a) const
+	{
+		a = std::fmod(a, total_len);
+		return a < 0 ? a + total_len : a;
+	}
+
+	// The segment arc length a (in [0, length())) falls on
+	int segment_at(double a) const
+	{
+		const auto it = std::upper_bound(arc_start.cbegin(), arc_start.cend(), a);
+		return std::max<int>(it - arc_start.cbegin() - 1, 0);
+	}
+
+	// Point and direction of the way at arc length s past the start
+	void pose_at(double s, Pt& center, Pt& course) const
+	{
+		const auto a = wrap(start_arc() + s);
+		const auto seg = segment_at(a);
+		const auto& p0 = points[seg];
+		const auto& p1 = points[(seg + 1) % count];
+		course = normalized(p1 - p0);
+		center = p0 + (a - arc_start[seg]) * course;
+	}
+
+	// Times the start line is crossed forwards, less the times it is
+	// crossed backwards, going `progress` along the way from arc length
+	// `from`
+	int laps(double from, double progress) const
+	{
+		return static_cast<int>(std::floor(
+			(wrap(from - start_arc()) + progress) / total_len));
+	}
+
+	// Like where_is(p), but only looks at the segments within `window`
+	// of hint.segment, so it stays cheap on ways with many segments.
+	WayPoint where_is(const Pt& p, const WayPoint& hint, int window) const
+	{
+		if(2 * window + 1 >= count) {
+			return where_is(p);
+		}
+		auto min_pr = Projection{WayPoint(), 1.0e20};
+		for(auto k = -window; k <= window; k++) {
+			const auto i = (hint.segment + k + count) % count;
+			const auto& a = points[i];
+			const auto& b = points[(i+1 == count) ? 0 : i+1];
+			auto pr = project(a, b, p, i);
+			if(pr.distance < min_pr.distance) {
+				min_pr = pr;
+			}
+		}
+		return min_pr.wp;
+	}
+
+	// Distance along the way from old to nw, negative when nw is behind
+	// old; takes the shorter way round the loop
+	double offset(const WayPoint& old, const WayPoint& nw) const
 	{
-		if(nw.segment == old.segment) {
-			return nw.offset - old.offset;
-		} else if ((nw.segment - old.segment == 1)
-			|| ((old.segment == count - 1) && (nw.segment == 0))) {
-			return segment_len[old.segment] - old.offset + nw.offset;
-		} else if ((old.segment - nw.segment == 1)
-			|| ((nw.segment == count - 1) && (old.segment == 0))) {
-			return segment_len[nw.segment] - nw.offset + old.offset;
-		} else {
-			// Should not be here
-			std::cout << "Should not be here!!! FIXME\n";
+		const auto d = arc(nw) - arc(old);
+		if(2 * d > total_len) {
+			return d - total_len;
+		}
+		if(2 * d <= -total_len) {
+			return d + total_len;
 		}
+		return d;
 	}
 };
 
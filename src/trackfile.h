@@ -0,0 +1,237 @@
+#ifndef __POLYGON_TRACKFILE_H
+#define __POLYGON_TRACKFILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "geom.h"
+#include "grid.h"
+#include "track.h"
+
+// On-disk track: a fixed header followed by 8-byte aligned arrays
+//
+//   uint32 path_sizes[npaths]   sections per wall path
+//   Sect   sects[nsects]        all wall sections, path after path
+//   Pt     points[npoints]      way polyline (closed)
+//   uint32 cell_start[nx*ny+1] SectGrid cells
+//   uint32 items[nitems]        SectGrid section indices
+//
+// Everything is host endian doubles/uint32s, so the file is only meant
+// to be read back on the same kind of machine it was written on.
+
+constexpr char TRACK_MAGIC[8] = {'P', 'L', 'G', 'T', 'R', 'A', 'C', 'K'};
+constexpr std::uint32_t TRACK_VERSION = 1;
+
+struct TrackFileHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t npaths;
+	std::uint64_t nsects;
+	std::uint64_t npoints;
+	double grid_origin_x;
+	double grid_origin_y;
+	double grid_cell;
+	std::uint32_t grid_nx;
+	std::uint32_t grid_ny;
+	std::uint64_t nitems;
+	std::uint64_t path_sizes_off;
+	std::uint64_t sects_off;
+	std::uint64_t points_off;
+	std::uint64_t cell_start_off;
+	std::uint64_t items_off;
+	std::uint64_t file_size;
+};
+
+static_assert(sizeof(Pt) == 2 * sizeof(Float), "Pt must be two Floats");
+static_assert(sizeof(Sect) == 2 * sizeof(Pt), "Sect must be two Pts");
+
+struct LoadedTrack
+{
+	std::shared_ptr<Figure> walls;
+	std::shared_ptr<Way> way;
+	std::shared_ptr<const SectGrid> grid;
+};
+
+inline std::uint64_t align8(std::uint64_t off)
+{
+	return (off + 7) & ~std::uint64_t(7);
+}
+
+void save_track(const std::string& path, const Figure& walls,
+	const std::vector<Pt>& way_points, const SectGrid& grid)
+{
+	TrackFileHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, TRACK_MAGIC, sizeof(h.magic));
+	h.version = TRACK_VERSION;
+	h.npaths = walls.paths.size();
+	h.nsects = grid.nsects;
+	h.npoints = way_points.size();
+	h.grid_origin_x = grid.origin.x;
+	h.grid_origin_y = grid.origin.y;
+	h.grid_cell = grid.cell;
+	h.grid_nx = grid.nx;
+	h.grid_ny = grid.ny;
+	h.nitems = grid.nitems;
+
+	const std::uint64_t ncells = std::uint64_t(grid.nx) * grid.ny + 1;
+	h.path_sizes_off = align8(sizeof(h));
+	h.sects_off = align8(h.path_sizes_off + 4 * h.npaths);
+	h.points_off = align8(h.sects_off + sizeof(Sect) * h.nsects);
+	h.cell_start_off = align8(h.points_off + sizeof(Pt) * h.npoints);
+	h.items_off = align8(h.cell_start_off + 4 * ncells);
+	h.file_size = h.items_off + 4 * h.nitems;
+
+	std::vector<std::uint32_t> path_sizes;
+	for(const auto& p: walls.paths) {
+		path_sizes.emplace_back(p.sects.size());
+	}
+
+	std::ofstream ofs(path, std::ios::binary);
+	if(!ofs) {
+		throw std::runtime_error("can't create track file " + path);
+	}
+	std::uint64_t pos = 0;
+	auto put = [&](std::uint64_t off, const void* data, std::uint64_t size) {
+		static const char zeros[8] = {};
+		ofs.write(zeros, off - pos);
+		ofs.write(static_cast<const char*>(data), size);
+		pos = off + size;
+	};
+	put(0, &h, sizeof(h));
+	put(h.path_sizes_off, path_sizes.data(), 4 * h.npaths);
+	put(h.sects_off, grid.sects, sizeof(Sect) * h.nsects);
+	put(h.points_off, way_points.data(), sizeof(Pt) * h.npoints);
+	put(h.cell_start_off, grid.cell_start, 4 * ncells);
+	put(h.items_off, grid.items, 4 * h.nitems);
+	if(!ofs) {
+		throw std::runtime_error("can't write track file " + path);
+	}
+}
+
+struct MappedFile
+{
+	void* addr = MAP_FAILED;
+	std::size_t size = 0;
+
+	~MappedFile()
+	{
+		if(addr != MAP_FAILED) {
+			munmap(addr, size);
+		}
+	}
+};
+
+// Maps the file read-only. Walls and way are copied out of the mapping
+// (one pass over contiguous memory); the grid points straight into it
+// and keeps the mapping alive for as long as it is used.
+LoadedTrack load_track(const std::string& path)
+{
+	auto fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0) {
+		throw std::runtime_error("can't open track file " + path);
+	}
+	struct stat st;
+	auto file = std::make_shared<MappedFile>();
+	if(fstat(fd, &st) == 0 && st.st_size >= sizeof(TrackFileHeader)) {
+		file->size = st.st_size;
+		file->addr = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(file->addr == MAP_FAILED) {
+		throw std::runtime_error("can't map track file " + path);
+	}
+
+	const auto base = static_cast<const char*>(file->addr);
+	const auto& h = *reinterpret_cast<const TrackFileHeader*>(base);
+	const std::uint64_t ncells = std::uint64_t(h.grid_nx) * h.grid_ny + 1;
+	// Every array 8-byte aligned, after the previous one and inside the
+	// file; counts are checked by division so they can't overflow
+	auto end = std::uint64_t(sizeof(TrackFileHeader));
+	auto fits = [&](std::uint64_t off, std::uint64_t count, std::uint64_t size) {
+		if(off % 8 != 0 || off < end || off > file->size
+			|| count > (file->size - off) / size) {
+			return false;
+		}
+		end = off + count * size;
+		return true;
+	};
+	if(std::memcmp(h.magic, TRACK_MAGIC, sizeof(h.magic)) != 0
+		|| h.version != TRACK_VERSION
+		|| h.file_size != file->size
+		|| h.npoints < 2
+		|| !(h.grid_cell > 0)
+		|| h.grid_nx == 0 || h.grid_ny == 0
+		|| !fits(h.path_sizes_off, h.npaths, 4)
+		|| !fits(h.sects_off, h.nsects, sizeof(Sect))
+		|| !fits(h.points_off, h.npoints, sizeof(Pt))
+		|| !fits(h.cell_start_off, ncells, 4)
+		|| !fits(h.items_off, h.nitems, 4)) {
+		throw std::runtime_error("bad track file " + path);
+	}
+
+	const auto path_sizes = reinterpret_cast<const std::uint32_t*>(
+		base + h.path_sizes_off);
+	const auto sects = reinterpret_cast<const Sect*>(base + h.sects_off);
+	const auto points = reinterpret_cast<const Pt*>(base + h.points_off);
+
+	// The grid is used without bounds checks: cells must index items in
+	// order, and items sections
+	const auto cell_start = reinterpret_cast<const std::uint32_t*>(
+		base + h.cell_start_off);
+	const auto items = reinterpret_cast<const std::uint32_t*>(base + h.items_off);
+	auto grid_ok = cell_start[0] == 0 && cell_start[ncells - 1] == h.nitems;
+	for(std::uint64_t i = 0; grid_ok && i + 1 < ncells; i++) {
+		grid_ok = cell_start[i] <= cell_start[i + 1];
+	}
+	for(std::uint64_t i = 0; grid_ok && i < h.nitems; i++) {
+		grid_ok = items[i] < h.nsects;
+	}
+	if(!grid_ok) {
+		throw std::runtime_error("bad track file " + path);
+	}
+
+	LoadedTrack track;
+	track.walls = std::make_shared<Figure>();
+	auto s = sects;
+	for(auto i = 0; i < h.npaths; i++) {
+		if(path_sizes[i] > sects + h.nsects - s) {
+			throw std::runtime_error("bad track file " + path);
+		}
+		track.walls->paths.emplace_back(
+			std::vector<Sect>(s, s + path_sizes[i]));
+		s += path_sizes[i];
+	}
+	if(s != sects + h.nsects) {
+		throw std::runtime_error("bad track file " + path);
+	}
+	track.way = std::make_shared<Way>(
+		std::vector<Pt>(points, points + h.npoints), 1.0);
+
+	auto grid = std::make_shared<SectGrid>();
+	grid->origin = Pt(h.grid_origin_x, h.grid_origin_y);
+	grid->cell = h.grid_cell;
+	grid->nx = h.grid_nx;
+	grid->ny = h.grid_ny;
+	grid->sects = sects;
+	grid->nsects = h.nsects;
+	grid->cell_start = cell_start;
+	grid->items = items;
+	grid->nitems = h.nitems;
+	grid->storage = file;
+	track.grid = grid;
+	return track;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef __POLYGON_TRACKGEN_H
+#define __POLYGON_TRACKGEN_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "geom.h"
+#include "track.h"
+
+struct TrackGenParams
+{
+	std::size_t segments = 1000;   // way segments; walls get as many each
+	double segment_len = 10.0;
+	double half_width = 4.0;       // like the d of make_track
+	double jitter = 0.0;           // wall noise, in units of half_width
+	std::size_t harmonics = 64;    // upper bound, curvature limits it too
+	unsigned seed = 1;
+};
+
+struct GeneratedTrack
+{
+	std::vector<Pt> way_points;
+	Figure walls;
+};
+
+// Seeded closed track of roughly params.segments * params.segment_len.
+//
+// The center line is a star-shaped curve r(t) = R (1 + sum a_k sin(k t + f_k))
+// with random amplitudes and phases. Amplitudes fall off as 1/k^2 and are
+// bounded so that r stays positive (the line can't cross itself) and the
+// radius of curvature stays above 3 * half_width (the walls can't either).
+// The curve is then resampled to equal arc lengths and both walls are
+// offset from it along the mitered normals.
+GeneratedTrack generate_track(const TrackGenParams& params)
+{
+	const auto n = std::max<std::size_t>(params.segments, 8);
+	const auto d = params.half_width;
+	const auto R = n * params.segment_len / (2.0 * M_PI);
+
+	std::mt19937 gen(params.seed);
+	std::uniform_real_distribution<double> ud(0.0, 1.0);
+
+	// sum_k c/k^2 < 0.65 c and sum_k (c/k^2) k^2 = c K
+	auto c = 0.7;
+	auto nh = std::max<std::size_t>(
+		std::min<std::size_t>(params.harmonics,
+			static_cast<std::size_t>(R / (3.0 * d * c))), 1);
+	c = std::min(c, R / (3.0 * d * nh));
+
+	std::vector<double> amp(nh), phase(nh);
+	for(auto k = 0; k < nh; k++) {
+		const auto kk = k + 2.0;
+		amp[k] = c * ud(gen) / (kk * kk);
+		phase[k] = 2.0 * M_PI * ud(gen);
+	}
+	auto curve = [&](double t) {
+		auto r = 1.0;
+		for(auto k = 0; k < nh; k++) {
+			r += amp[k] * std::sin((k + 2.0) * t + phase[k]);
+		}
+		return R * r * Pt(std::cos(t), std::sin(t));
+	};
+
+	// dense sampling, then equal arc length resampling
+	const auto m = 8 * n;
+	std::vector<Pt> dense(m + 1);
+	std::vector<double> acc(m + 1, 0.0);
+	for(auto i = 0; i <= m; i++) {
+		dense[i] = curve(2.0 * M_PI * i / m);
+		if(i > 0) {
+			acc[i] = acc[i-1] + (dense[i] - dense[i-1]).norm();
+		}
+	}
+	GeneratedTrack track;
+	track.way_points.reserve(n);
+	auto j = 0;
+	for(auto i = 0; i < n; i++) {
+		const auto s = acc[m] * i / n;
+		while(acc[j+1] < s) {
+			j++;
+		}
+		const auto lambda = (s - acc[j]) / (acc[j+1] - acc[j]);
+		track.way_points.emplace_back(dense[j] + lambda * (dense[j+1] - dense[j]));
+	}
+
+	std::normal_distribution<Float> nd(0, params.jitter * d);
+	std::vector<Pt> outer, inner;
+	outer.reserve(n);
+	inner.reserve(n);
+	const auto& ps = track.way_points;
+	for(auto i = 0; i < n; i++) {
+		const auto& prev = ps[(i + n - 1) % n];
+		const auto& next = ps[(i + 1) % n];
+		const auto e1 = normalized(ps[i] - prev);
+		const auto e2 = normalized(next - ps[i]);
+		const auto nrm = normalized(e1.rperp() + e2.rperp());
+		const auto miter = d / std::max(dot(nrm, e2.rperp()), 0.5);
+		auto z1 = ps[i] + miter * nrm;
+		auto z2 = ps[i] - miter * nrm;
+		if(params.jitter > 0) {
+			z1 = z1 + Pt(nd(gen), nd(gen));
+			z2 = z2 + Pt(nd(gen), nd(gen));
+		}
+		outer.emplace_back(z1);
+		inner.emplace_back(z2);
+	}
+	track.walls = Figure::compound({Figure::closed_path(outer),
+									Figure::closed_path(inner)});
+	return track;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __POLYGON_TRACKPOOL_H
+#define __POLYGON_TRACKPOOL_H
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "geom.h"
+#include "grid.h"
+#include "track.h"
+#include "trackfile.h"
+
+// Immutable track: walls, way and the grid over the walls. Worlds only
+// hold shared pointers to it, so a track costs the same memory whether
+// one world or thousands drive on it.
+struct Track
+{
+	std::string name;
+	std::shared_ptr<const Figure> walls;
+	std::shared_ptr<const Way> way;
+	std::shared_ptr<const SectGrid> grid;
+
+	static std::shared_ptr<const Track> make(const std::string& aname,
+		std::shared_ptr<const Figure> awalls, std::shared_ptr<const Way> away,
+		std::shared_ptr<const SectGrid> agrid = nullptr)
+	{
+		auto t = std::make_shared<Track>();
+		t->name = aname;
+		t->walls = awalls;
+		t->way = away;
+		t->grid = agrid ? agrid
+			: std::make_shared<SectGrid>(SectGrid::build(*awalls));
+		return t;
+	}
+
+	// Copy sharing no memory with this one, e.g. for another NUMA node:
+	// the walls, the way and the grid are all allocated anew by the
+	// calling thread
+	std::shared_ptr<const Track> replicate() const
+	{
+		auto walls_copy = std::make_shared<Figure>(*walls);
+		return make(name, walls_copy, std::make_shared<Way>(*way),
+			std::make_shared<SectGrid>(SectGrid::build(*walls_copy, grid->cell)));
+	}
+
+	static std::shared_ptr<const Track> load(const std::string& path)
+	{
+		auto loaded = load_track(path);
+		return make(path, loaded.walls, loaded.way, loaded.grid);
+	}
+
+	// Named after its seed and scale, so that TrackPool keeps different
+	// clovers apart
+	static std::shared_ptr<const Track> clover(
+		unsigned seed = std::mt19937::default_seed, double scale = 10.0)
+	{
+		std::ostringstream name;
+		name << "clover seed " << seed << " scale " << scale;
+		return make(name.str(),
+			std::make_shared<Figure>(::clover(4.0, scale, seed)),
+			std::make_shared<Way>(clover_data, scale));
+	}
+};
+
+// Set of tracks worlds are spread over. Tracks are added once, before
+// the pool is shared, and never change afterwards.
+class TrackPool
+{
+public:
+	TrackPool() {}
+
+	explicit TrackPool(std::shared_ptr<const Track> track)
+	{
+		add(track);
+	}
+
+	std::shared_ptr<const Track> add(std::shared_ptr<const Track> track)
+	{
+		for(const auto& t: tracks) {
+			if(t->name == track->name) {
+				return t;
+			}
+		}
+		tracks.emplace_back(track);
+		return track;
+	}
+
+	// Loads a track file unless one with the same path is in the pool
+	std::shared_ptr<const Track> load(const std::string& path)
+	{
+		for(const auto& t: tracks) {
+			if(t->name == path) {
+				return t;
+			}
+		}
+		return add(Track::load(path));
+	}
+
+	// By the name a track had in the pool, e.g. in a trajectory log: a
+	// clover (Track::clover, or plain "clover" for its defaults) or a
+	// track file
+	std::shared_ptr<const Track> load_named(const std::string& name)
+	{
+		if(name == "clover") {
+			return add(Track::clover());
+		}
+		std::istringstream in(name);
+		std::string word, seed_word, scale_word;
+		unsigned seed;
+		double scale;
+		if(in >> word >> seed_word >> seed >> scale_word >> scale
+			&& word == "clover" && seed_word == "seed" && scale_word == "scale") {
+			return add(Track::clover(seed, scale));
+		}
+		return load(name);
+	}
+
+	// Same tracks in the same order, see Track::replicate()
+	TrackPool replicate() const
+	{
+		TrackPool res;
+		for(const auto& t: tracks) {
+			res.tracks.emplace_back(t->replicate());
+		}
+		return res;
+	}
+
+	const std::shared_ptr<const Track>& operator[](std::size_t i) const
+	{
+		return tracks[i % tracks.size()];
+	}
+
+	std::size_t size() const
+	{
+		return tracks.size();
+	}
+
+	bool empty() const
+	{
+		return tracks.empty();
+	}
+
+private:
+	std::vector<std::shared_ptr<const Track>> tracks;
+};
+
+#endif
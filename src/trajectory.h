@@ -0,0 +1,356 @@
+#ifndef __POLYGON_TRAJECTORY_H
+#define __POLYGON_TRAJECTORY_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trackfile.h"
+#include "trackpool.h"
+#include "trace.h"
+
+// Trajectory log: everything the worlds did, tick by tick.
+//
+//   TrajectoryHeader
+//   ntracks x (uint32 length, name bytes), padded to 8 bytes
+//   chunks: ChunkHeader, then nticks x nworlds TickRecords, tick-major
+//
+// A record holds the state of one world after a tick; the state before
+// it is the previous record of the same world, if it has the same
+// episode number. Everything is host endian. The last magic byte is the
+// format version; 2 added the steps an action was held for.
+
+constexpr char TRAJECTORY_MAGIC[8] = {'P', 'L', 'G', 'T', 'R', 'A', 'J', '2'};
+constexpr std::uint32_t CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+
+struct TrajectoryHeader
+{
+	char magic[8];
+	std::uint32_t nworlds;
+	std::uint32_t nrays;
+	std::uint32_t na;
+	std::uint32_t ntracks;
+	std::uint32_t record_size;
+	std::uint32_t reserved;
+};
+
+struct ChunkHeader
+{
+	std::uint32_t magic;
+	std::uint32_t nticks;
+	std::uint64_t first_tick;
+};
+
+template <std::size_t NRAYS, std::size_t NA>
+struct TickRecord
+{
+	float x, y;                 // car center
+	float course_x, course_y;
+	float speed;
+	float wheels_angle;
+	float reward;               // raw, mean of the held steps
+	float learn_reward;         // what the learner got: normalized, discounted sum
+	float action[NA];
+	float state[NRAYS];         // World::state after the tick
+	std::uint32_t track;        // index into the header's track names
+	std::uint32_t episode;
+	std::uint32_t steps;        // physics steps the action was held for
+	std::uint32_t reserved;
+};
+
+// Appends the worlds of every tick to a log. record() only copies into a
+// preallocated chunk; full chunks go to a background thread that writes
+// them, and are recycled afterwards.
+template <std::size_t NRAYS, std::size_t NA>
+class Recorder
+{
+public:
+	typedef TickRecord<NRAYS, NA> Record;
+
+	Recorder(const std::string& path, const TrackPool& pool,
+		std::size_t anworlds, std::size_t aticks_per_chunk = 256,
+		std::size_t nbuffers = 4)
+		: ofs(path, std::ios::binary),
+		  nworlds(anworlds), ticks_per_chunk(aticks_per_chunk)
+	{
+		if(!ofs) {
+			throw std::runtime_error("can't create trajectory log " + path);
+		}
+		TrajectoryHeader h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic));
+		h.nworlds = nworlds;
+		h.nrays = NRAYS;
+		h.na = NA;
+		h.ntracks = pool.size();
+		h.record_size = sizeof(Record);
+		ofs.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		std::uint64_t pos = sizeof(h);
+		for(auto i = 0; i < pool.size(); i++) {
+			tracks.emplace_back(pool[i].get());
+			const auto& name = pool[i]->name;
+			const std::uint32_t len = name.size();
+			ofs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+			ofs.write(name.data(), len);
+			pos += sizeof(len) + len;
+		}
+		static const char zeros[8] = {};
+		ofs.write(zeros, align8(pos) - pos);
+
+		// both lists have room for every chunk, so handing chunks back
+		// and forth never allocates
+		free_chunks.reserve(nbuffers);
+		full_chunks.reserve(nbuffers);
+		for(auto i = 0; i < nbuffers; i++) {
+			free_chunks.emplace_back(new Chunk(ticks_per_chunk * nworlds));
+		}
+		current = take_free();
+		writer = std::thread([this]() { write_loop(); });
+	}
+
+	~Recorder()
+	{
+		if(current->nticks > 0) {
+			submit(std::move(current));
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done = true;
+		}
+		cv.notify_all();
+		writer.join();
+	}
+
+	// held[j] is the last action of worlds[j], as Polygon::HeldAction
+	template <typename W, typename H>
+	void record(const std::vector<W>& worlds, const std::vector<H>& held)
+	{
+		TRACE_SCOPE("Recorder::record");
+		auto* r = current->records.data() + current->nticks * nworlds;
+		for(auto j = 0; j < nworlds; j++, r++) {
+			const auto& w = worlds[j];
+			r->x = w.car.center.x;
+			r->y = w.car.center.y;
+			r->course_x = w.car.course.x;
+			r->course_y = w.car.course.y;
+			r->speed = w.car.speed;
+			r->wheels_angle = w.car.wheels_angle;
+			r->reward = w.last_reward;
+			r->learn_reward = held[j].learn_reward;
+			std::copy(w.last_action.cbegin(), w.last_action.cend(), r->action);
+			std::copy(w.state.cbegin(), w.state.cend(), r->state);
+			r->track = track_index(w.track.get());
+			r->episode = w.episode;
+			r->steps = held[j].steps;
+			r->reserved = 0;
+		}
+		if(current->nticks == 0) {
+			current->first_tick = tick;
+		}
+		current->nticks++;
+		tick++;
+		if(current->nticks == ticks_per_chunk) {
+			submit(std::move(current));
+			current = take_free();
+		}
+	}
+
+private:
+	struct Chunk
+	{
+		explicit Chunk(std::size_t n) : records(n) {}
+
+		std::vector<Record> records;
+		std::size_t nticks = 0;
+		std::uint64_t first_tick = 0;
+	};
+
+	std::uint32_t track_index(const Track* t) const
+	{
+		for(auto i = 0; i < tracks.size(); i++) {
+			if(tracks[i] == t) {
+				return i;
+			}
+		}
+		return 0;
+	}
+
+	std::unique_ptr<Chunk> take_free()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this]() { return !free_chunks.empty(); });
+		auto c = std::move(free_chunks.back());
+		free_chunks.pop_back();
+		c->nticks = 0;
+		return c;
+	}
+
+	void submit(std::unique_ptr<Chunk> c)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			full_chunks.emplace_back(std::move(c));
+		}
+		cv.notify_all();
+	}
+
+	void write_loop()
+	{
+		Tracer::instance().thread_name("trajectory writer");
+		for(;;) {
+			std::unique_ptr<Chunk> c;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this]() { return done || !full_chunks.empty(); });
+				if(full_chunks.empty()) {
+					break;
+				}
+				c = std::move(full_chunks.front());
+				full_chunks.erase(full_chunks.begin());
+			}
+			{
+				TRACE_SCOPE("write chunk");
+				ChunkHeader h{CHUNK_MAGIC, static_cast<std::uint32_t>(c->nticks),
+					c->first_tick};
+				ofs.write(reinterpret_cast<const char*>(&h), sizeof(h));
+				ofs.write(reinterpret_cast<const char*>(c->records.data()),
+					sizeof(Record) * c->nticks * nworlds);
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				free_chunks.emplace_back(std::move(c));
+			}
+			cv.notify_all();
+		}
+		ofs.flush();
+	}
+
+	std::ofstream ofs;
+	std::size_t nworlds;
+	std::size_t ticks_per_chunk;
+	std::vector<const Track*> tracks;
+	std::uint64_t tick = 0;
+
+	std::unique_ptr<Chunk> current;
+	std::vector<std::unique_ptr<Chunk>> free_chunks;
+	std::vector<std::unique_ptr<Chunk>> full_chunks; // oldest first
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool done = false;
+	std::thread writer;
+};
+
+// Read-only view of a trajectory log through mmap. Chunks are indexed
+// once on open; records are then read in place.
+template <std::size_t NRAYS, std::size_t NA>
+class TrajectoryLog
+{
+public:
+	typedef TickRecord<NRAYS, NA> Record;
+
+	std::vector<std::string> track_names;
+	std::size_t nworlds = 0;
+
+	explicit TrajectoryLog(const std::string& path)
+		: file(std::make_shared<MappedFile>())
+	{
+		auto fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0) {
+			throw std::runtime_error("can't open trajectory log " + path);
+		}
+		struct stat st;
+		if(fstat(fd, &st) == 0 && st.st_size >= sizeof(TrajectoryHeader)) {
+			file->size = st.st_size;
+			file->addr = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if(file->addr == MAP_FAILED) {
+			throw std::runtime_error("can't map trajectory log " + path);
+		}
+
+		const auto base = static_cast<const char*>(file->addr);
+		const auto end = base + file->size;
+		const auto& h = *reinterpret_cast<const TrajectoryHeader*>(base);
+		if(std::memcmp(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic) - 1) == 0
+			&& h.magic[7] != TRAJECTORY_MAGIC[7]) {
+			throw std::runtime_error("trajectory log " + path
+				+ " is of an older format, record it again");
+		}
+		if(std::memcmp(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic)) != 0
+			|| h.nrays != NRAYS || h.na != NA
+			|| h.record_size != sizeof(Record) || h.nworlds == 0) {
+			throw std::runtime_error("bad trajectory log " + path);
+		}
+		nworlds = h.nworlds;
+
+		auto p = base + sizeof(h);
+		for(auto i = 0; i < h.ntracks; i++) {
+			std::uint32_t len;
+			if(end - p < sizeof(len)) {
+				throw std::runtime_error("bad trajectory log " + path);
+			}
+			std::memcpy(&len, p, sizeof(len));
+			p += sizeof(len);
+			if(end - p < len) {
+				throw std::runtime_error("bad trajectory log " + path);
+			}
+			track_names.emplace_back(p, len);
+			p += len;
+		}
+		p = base + align8(p - base);
+
+		// a truncated last chunk (e.g. the trainer was killed) is dropped
+		const auto tick_size = sizeof(Record) * nworlds;
+		while(end - p >= sizeof(ChunkHeader)) {
+			ChunkHeader ch;
+			std::memcpy(&ch, p, sizeof(ch));
+			p += sizeof(ch);
+			if(ch.magic != CHUNK_MAGIC || (end - p) / tick_size < ch.nticks) {
+				break;
+			}
+			chunks.push_back({ntick, reinterpret_cast<const Record*>(p)});
+			ntick += ch.nticks;
+			p += ch.nticks * tick_size;
+		}
+	}
+
+	std::size_t ticks() const
+	{
+		return ntick;
+	}
+
+	// The nworlds records of tick t (counted from the start of the log)
+	const Record* tick(std::size_t t) const
+	{
+		auto it = std::upper_bound(chunks.cbegin(), chunks.cend(), t,
+			[](std::size_t t, const ChunkRef& c) { return t < c.first; });
+		--it;
+		return it->records + (t - it->first) * nworlds;
+	}
+
+private:
+	struct ChunkRef
+	{
+		std::size_t first;
+		const Record* records;
+	};
+
+	std::shared_ptr<MappedFile> file;
+	std::vector<ChunkRef> chunks;
+	std::size_t ntick = 0;
+};
+
+#endif
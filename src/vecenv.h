@@ -0,0 +1,213 @@
+#ifndef __POLYGON_VECENV_H
+#define __POLYGON_VECENV_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "trace.h"
+#include "trackpool.h"
+#include "workers.h"
+#include "world.h"
+
+// N worlds stepped together for training code outside this repo (see
+// env.h for the C interface). Observations, rewards and done flags go
+// straight into buffers the caller owns and binds once, laid out world
+// after world; step() reads the actions from one such buffer too. Once
+// bound, nothing is copied or allocated per step: every world senses
+// right into its row of observations (World::bind_input).
+//
+// Observations are the ray distances normalized to [-1, 1], as the
+// learner of a Polygon sees them; rewards are World::reward(). A world
+// is done when its episode ends (see EpisodeLimits); the done flag is
+// then the Ending. The world starts over right away on the next track
+// of the pool, at a random spot of the way unless fixed_starts: its
+// observation is already the first one of the new episode, as is usual
+// for vectorized environments.
+//
+// Every thread of the pool owns a fixed, contiguous partition of the
+// worlds, allocated and stepped by that thread only. With pinned
+// threads (see WorkerPool) a partition thus lives on the NUMA node of
+// its thread, and so does the copy of the tracks its worlds drive on:
+// every node gets its own replica of the pool.
+template <std::size_t NRAYS, std::size_t NA, typename Layout = UniformRays>
+class VecEnv
+{
+public:
+	// Worlds are spread round-robin over the tracks. Unpinned, nthreads = 1
+	// steps them on the calling thread only; pinned, on nthreads threads
+	// of their own.
+	VecEnv(std::shared_ptr<const TrackPool> atracks, std::size_t anworlds,
+		const EpisodeLimits& alimits = EpisodeLimits(), double adt = 0.1,
+		unsigned nthreads = 1, std::uint64_t aseed = 1, bool afixed_starts = false,
+		bool pinned = false)
+		: tracks(std::move(atracks)),
+		  minmax(state_ranges<NRAYS>()),
+		  limits(alimits),
+		  dt(adt),
+		  seed(aseed),
+		  fixed_starts(afixed_starts),
+		  nworlds(anworlds),
+		  workers(nthreads, pinned)
+	{
+		if(!tracks || tracks->empty()) {
+			throw std::runtime_error("VecEnv needs at least one track");
+		}
+		node_tracks.assign(workers.num_nodes(), tracks);
+		if(workers.num_nodes() > 1) {
+			// by the first thread of every node
+			workers.each([&](std::size_t t) {
+				if(t == 0 || workers.node(t) != workers.node(t - 1)) {
+					node_tracks[workers.node(t)] =
+						std::make_shared<const TrackPool>(tracks->replicate());
+				}
+			});
+		}
+		parts.resize(workers.size());
+		workers.each([&](std::size_t t) {
+			std::unique_ptr<Partition> part(new Partition);
+			part->first = nworlds * t / workers.size();
+			part->tracks = node_tracks[workers.node(t)];
+			const auto end = nworlds * (t + 1) / workers.size();
+			part->worlds.reserve(end - part->first);
+			for(auto i = part->first; i < end; i++) {
+				part->worlds.emplace_back((*part->tracks)[i]);
+				part->worlds.back().limits = limits;
+			}
+			parts[t] = std::move(part);
+		});
+	}
+
+	std::size_t size() const
+	{
+		return nworlds;
+	}
+
+	// obs: size() * NRAYS values, rewards: size(), dones: size()
+	void bind(Float* aobs, Float* arewards, std::uint8_t* adones)
+	{
+		if(!aobs || !arewards || !adones) {
+			throw std::runtime_error("VecEnv::bind: null buffer");
+		}
+		obs = aobs;
+		rewards = arewards;
+		dones = adones;
+		for(auto& part: parts) {
+			for(auto k = 0; k < part->worlds.size(); k++) {
+				part->worlds[k].bind_input(obs + (part->first + k) * NRAYS, minmax);
+			}
+		}
+	}
+
+	// Every world to the start of its next track
+	void reset()
+	{
+		check_bound();
+		workers.each([&](std::size_t t) {
+			auto& part = *parts[t];
+			for(auto k = 0; k < part.worlds.size(); k++) {
+				restart(part, k);
+				rewards[part.first + k] = 0;
+				dones[part.first + k] = 0;
+			}
+		});
+	}
+
+	// actions: size() * NA values
+	void step(const Float* actions)
+	{
+		check_bound();
+		TRACE_SCOPE("VecEnv::step");
+		workers.each([&](std::size_t t) {
+			auto& part = *parts[t];
+			for(auto k = 0; k < part.worlds.size(); k++) {
+				step_world(part, k, actions + (part.first + k) * NA);
+			}
+		});
+	}
+
+	const World<NRAYS, NA, Layout>& world(std::size_t i) const
+	{
+		const auto t = std::upper_bound(parts.cbegin(), parts.cend(), i,
+			[](std::size_t i, const std::unique_ptr<Partition>& part) {
+				return i < part->first;
+			}) - parts.cbegin() - 1;
+		return parts[t]->worlds[i - parts[t]->first];
+	}
+
+	// Time every thread spent stepping its worlds since the last call,
+	// for utilization and imbalance (see PoolUsage)
+	PoolUsage usage()
+	{
+		const auto res = workers.usage();
+		workers.reset_usage();
+		return res;
+	}
+
+	const WorkerPool& pool() const
+	{
+		return workers;
+	}
+
+private:
+	// Worlds first .. first + worlds.size() - 1, of one thread
+	struct Partition
+	{
+		std::size_t first = 0;
+		std::vector<World<NRAYS, NA, Layout>> worlds;
+		std::shared_ptr<const TrackPool> tracks; // replica of its node
+	};
+
+	void check_bound() const
+	{
+		if(!obs) {
+			throw std::runtime_error("VecEnv: buffers not bound");
+		}
+	}
+
+	void step_world(Partition& part, std::size_t k, const Float* action)
+	{
+		const auto i = part.first + k;
+		auto& world = part.worlds[k];
+		std::array<Float, NA> a;
+		std::copy(action, action + NA, a.begin());
+		world.act(a, dt);
+		rewards[i] = world.reward();
+		world.last_reward = rewards[i];
+		dones[i] = static_cast<std::uint8_t>(world.ending);
+		if(world.done()) {
+			restart(part, k);
+		}
+	}
+
+	// Only touches one world, so worlds can restart from any thread. World
+	// i drives tracks i, i + size(), i + 2 size()... of the pool in turn.
+	void restart(Partition& part, std::size_t k)
+	{
+		const auto i = part.first + k;
+		auto& world = part.worlds[k];
+		world.set_track((*part.tracks)[i + world.episode * nworlds]);
+		if(!fixed_starts) {
+			world.restart_at(random_start(*world.track->way, seed, i, world.episode));
+		}
+	}
+
+	std::shared_ptr<const TrackPool> tracks;
+	std::vector<std::shared_ptr<const TrackPool>> node_tracks;
+	MinMax<NRAYS> minmax;
+	EpisodeLimits limits;
+	double dt;
+	std::uint64_t seed; // of the random starts
+	bool fixed_starts;
+	std::size_t nworlds;
+	WorkerPool workers;
+	std::vector<std::unique_ptr<Partition>> parts; // of every thread
+	Float* obs = nullptr;
+	Float* rewards = nullptr;
+	std::uint8_t* dones = nullptr;
+};
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef __POLYGON_WORKERS_H
+#define __POLYGON_WORKERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "numa.h"
+
+// Time the threads of a WorkerPool spent running tasks
+struct PoolUsage
+{
+	double seconds = 0;             // wall time covered
+	std::vector<double> busy;       // seconds in tasks, per thread
+	std::vector<std::size_t> tasks; // per thread
+
+	double utilization(unsigned t) const
+	{
+		return seconds > 0 ? busy[t] / seconds : 0.0;
+	}
+
+	// Busiest thread against the mean, 1 when perfectly balanced
+	double imbalance() const
+	{
+		auto sum = 0.0, top = 0.0;
+		for(auto b: busy) {
+			sum += b;
+			top = std::max(top, b);
+		}
+		return sum > 0 ? top * busy.size() / sum : 1.0;
+	}
+};
+
+// Allocator of vectors whose elements start on cache lines of their own
+// when the type is alignas(64); plain new doesn't align that far before
+// C++17
+template <typename T>
+struct LineAllocator
+{
+	typedef T value_type;
+
+	LineAllocator() = default;
+
+	template <typename U>
+	LineAllocator(const LineAllocator<U>&) {}
+
+	T* allocate(std::size_t n)
+	{
+		void* p = nullptr;
+		if(posix_memalign(&p, 64, n * sizeof(T)) != 0) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, std::size_t)
+	{
+		std::free(p);
+	}
+
+	template <typename U>
+	bool operator==(const LineAllocator<U>&) const
+	{
+		return true;
+	}
+
+	template <typename U>
+	bool operator!=(const LineAllocator<U>&) const
+	{
+		return false;
+	}
+};
+
+// Fixed set of threads that run the tasks of one job at a time. run()
+// hands out task indices [0, ntasks) to the workers and the calling
+// thread alike and returns when all of them are done, so it can be
+// called many times per second (e.g. once per minibatch) without
+// starting threads each time. Which thread gets which task is not
+// fixed; callers that need reproducible results write per-task outputs
+// and combine them in task order.
+//
+// each() instead runs one task on every thread, always the same one on
+// the same thread, for work split into fixed per-thread partitions.
+//
+// A pinned pool starts a thread per partition, the calling thread only
+// waits, and each thread is pinned to one CPU. Consecutive threads
+// share a NUMA node (see CpuTopology::place), so memory a thread
+// allocates and first touches in its each() tasks stays on its node.
+// Pinning is best effort: where the OS refuses, threads just float.
+class WorkerPool
+{
+public:
+	explicit WorkerPool(unsigned anthreads = std::thread::hardware_concurrency(),
+		bool apinned = false)
+		: nthreads(std::max(anthreads, 1u)),
+		  pinned(apinned),
+		  nodes(nthreads, 0),
+		  slots(nthreads)
+	{
+		std::vector<int> cpus(nthreads, -1);
+		if(pinned) {
+			const auto topology = CpuTopology::detect();
+			nodes = topology.place(nthreads);
+			nnodes = topology.nodes.size();
+			std::vector<std::size_t> used(nnodes, 0);
+			for(auto t = 0; t < nthreads; t++) {
+				const auto& node_cpus = topology.nodes[nodes[t]];
+				cpus[t] = node_cpus[used[nodes[t]]++ % node_cpus.size()];
+			}
+		}
+		for(auto t = pinned ? 0u : 1u; t < nthreads; t++) {
+			const auto cpu = cpus[t];
+			threads.emplace_back([this, t, cpu]() {
+				if(cpu >= 0) {
+					pin_this_thread({cpu});
+				}
+				work_loop(t);
+			});
+		}
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done = true;
+		}
+		cv.notify_all();
+		for(auto& t: threads) {
+			t.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	unsigned size() const
+	{
+		return nthreads;
+	}
+
+	bool is_pinned() const
+	{
+		return pinned;
+	}
+
+	// NUMA node of thread t, 0 unless pinned
+	unsigned node(unsigned t) const
+	{
+		return nodes[t];
+	}
+
+	unsigned num_nodes() const
+	{
+		return nnodes;
+	}
+
+	template <typename F>
+	void run(std::size_t ntasks, F&& f)
+	{
+		if(ntasks == 0) {
+			return;
+		}
+		if(!pinned && (nthreads == 1 || ntasks == 1)) {
+			const auto t0 = std::chrono::steady_clock::now();
+			for(auto i = 0; i < ntasks; i++) {
+				f(i);
+			}
+			account(0, t0, ntasks);
+			return;
+		}
+		start(std::ref(f), ntasks, false);
+	}
+
+	// f(t) on thread t, for every thread
+	template <typename F>
+	void each(F&& f)
+	{
+		if(!pinned && nthreads == 1) {
+			const auto t0 = std::chrono::steady_clock::now();
+			f(0);
+			account(0, t0, 1);
+			return;
+		}
+		start(std::ref(f), nthreads, true);
+	}
+
+	// Folds items [0, n) into item 0 pairwise: combine(i, j) adds item j
+	// into item i. Rounds run in parallel, but every item is combined in
+	// the same order whatever the number of threads.
+	template <typename F>
+	void reduce(std::size_t n, F&& combine)
+	{
+		for(std::size_t step = 1; step < n; step *= 2) {
+			run((n + 2 * step - 1) / (2 * step), [&](std::size_t k) {
+				const auto i = 2 * step * k;
+				if(i + step < n) {
+					combine(i, i + step);
+				}
+			});
+		}
+	}
+
+	// Since the pool started or the last reset_usage(); call between jobs
+	PoolUsage usage() const
+	{
+		PoolUsage res;
+		res.seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - usage_since).count();
+		for(const auto& s: slots) {
+			res.busy.push_back(s.busy);
+			res.tasks.push_back(s.tasks);
+		}
+		return res;
+	}
+
+	void reset_usage()
+	{
+		for(auto& s: slots) {
+			s.busy = 0;
+			s.tasks = 0;
+		}
+		usage_since = std::chrono::steady_clock::now();
+	}
+
+private:
+	// A cache line each, as every thread bumps its own
+	struct alignas(64) Slot
+	{
+		double busy = 0;
+		std::size_t tasks = 0;
+	};
+
+	void start(std::function<void(std::size_t)> f, std::size_t ntasks,
+		bool per_thread)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = std::move(f);
+			job_per_thread = per_thread;
+			njob_tasks = ntasks;
+			next_task = 0;
+			pending = ntasks;
+			generation++;
+		}
+		cv.notify_all();
+		if(!pinned) {
+			take_tasks(0, job, ntasks, per_thread);
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [this]() { return pending == 0 && busy == 0; });
+		job = nullptr;
+	}
+
+	void account(unsigned t, std::chrono::steady_clock::time_point t0,
+		std::size_t ntasks)
+	{
+		slots[t].busy += std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - t0).count();
+		slots[t].tasks += ntasks;
+	}
+
+	void take_tasks(unsigned self, const std::function<void(std::size_t)>& f,
+		std::size_t ntasks, bool per_thread)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		std::size_t ndone = 0;
+		if(per_thread) {
+			f(self);
+			ndone = 1;
+		} else {
+			for(;;) {
+				const auto i = next_task.fetch_add(1);
+				if(i >= ntasks) {
+					break;
+				}
+				f(i);
+				ndone++;
+			}
+		}
+		if(ndone > 0) {
+			account(self, t0, ndone);
+			std::lock_guard<std::mutex> lock(mutex);
+			pending -= ndone;
+			if(pending == 0) {
+				done_cv.notify_all();
+			}
+		}
+	}
+
+	// A worker joins a job under the lock, only while some of its tasks
+	// are pending, and is counted busy until it leaves it. start() returns
+	// only once no task is pending and no worker is busy, so a worker that
+	// wakes up late for a finished job skips it instead of running the
+	// next job's tasks with this one's count. The job is copied under the
+	// lock too, as start() replaces it.
+	void work_loop(unsigned self)
+	{
+		unsigned seen = 0;
+		std::function<void(std::size_t)> f;
+		for(;;) {
+			std::size_t ntasks;
+			bool per_thread;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this, seen]() {
+					return done || generation != seen;
+				});
+				if(done) {
+					return;
+				}
+				seen = generation;
+				if(pending == 0) {
+					continue;
+				}
+				f = job;
+				ntasks = njob_tasks;
+				per_thread = job_per_thread;
+				busy++;
+			}
+			take_tasks(self, f, ntasks, per_thread);
+			std::lock_guard<std::mutex> lock(mutex);
+			if(--busy == 0 && pending == 0) {
+				done_cv.notify_all();
+			}
+		}
+	}
+
+	unsigned nthreads;
+	bool pinned;
+	std::vector<unsigned> nodes; // of every thread
+	unsigned nnodes = 1;
+	std::vector<Slot, LineAllocator<Slot>> slots;
+	std::chrono::steady_clock::time_point usage_since =
+		std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::condition_variable done_cv;
+	std::function<void(std::size_t)> job;
+	bool job_per_thread = false;
+	std::size_t njob_tasks = 0;
+	std::atomic<std::size_t> next_task{0};
+	std::size_t pending = 0;
+	unsigned busy = 0;
+	unsigned generation = 0;
+	bool done = false;
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef __POLYGON_WORLD_H
+#define __POLYGON_WORLD_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include "geom.h"
+#include "car.h"
+#include "trace.h"
+#include "track.h"
+#include "trackpool.h"
+
+// A car on a track and what it senses, without a learner: shared by
+// Polygon and the environment library (env.h).
+
+constexpr Range TRANGE = Range{-1, 1};
+
+inline Float normalize(const Range& from, Float x, const Range& to)
+{
+	return to.lo + (x - from.lo) * (to.hi - to.lo) / (from.hi - from.lo);
+}
+
+template <std::size_t N>
+struct MinMax
+{
+	std::array<Range, N> ranges;
+	// normalize(ranges[i], x, TRANGE) as x * scale[i] + shift[i]
+	std::array<Float, N> scale;
+	std::array<Float, N> shift;
+
+	template <typename T>
+	MinMax(const T& aranges)
+	{
+		std::copy(aranges.cbegin(), aranges.cbegin() + N, ranges.begin());
+		for(auto i = 0; i < N; i++) {
+			const auto& r = ranges[i];
+			scale[i] = (TRANGE.hi - TRANGE.lo) / (r.hi - r.lo);
+			shift[i] = TRANGE.lo - r.lo * scale[i];
+		}
+	}
+
+	template <typename C1, typename C2>
+	void norm(const C1& c1, C2& c2) const
+	{
+		for(auto i = 0; i < N; i++) {
+			c2[i] = c1[i] * scale[i] + shift[i];
+		}
+	}
+};
+
+// Ray distances are normalized from this range
+template <std::size_t NRAYS>
+std::array<Range, NRAYS> state_ranges()
+{
+	std::array<Range, NRAYS> res;
+	res.fill({-5, 20});
+	return res;
+}
+
+// Why an episode ended; the values are the done flags of env.h
+enum class Ending
+{
+	none = 0,
+	stuck = 1,      // pushed against something for stuck_steps steps in a row
+	wrong_way = 2,  // driven wrong_way back along the way
+	step_limit = 3
+};
+
+// When a World's episode ends; 0 turns a limit off
+struct EpisodeLimits
+{
+	unsigned max_steps = 0;
+	unsigned stuck_steps = 30;
+	double wrong_way = 15.0;
+};
+
+// Arc length along way to start an episode at, random but a function of
+// (seed, world, episode) only, so that worlds restarting in any order or
+// on any thread get the same starts
+inline double random_start(const Way& way, std::uint64_t seed,
+	std::uint64_t world, std::uint64_t episode)
+{
+	// splitmix64
+	auto z = seed + 0x9E3779B97F4A7C15ull * (1 + world + (episode << 32));
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z ^= z >> 31;
+	return (z >> 11) * (1.0 / 9007199254740992.0) * way.length();
+}
+
+// What changes as a World drives, and nothing it shares with other
+// worlds: a few dozen bytes that copy with memcpy. World::save() and
+// load() fork and rewind simulations with it; the sensor readings are
+// not kept but sensed again on load().
+template <std::size_t NA>
+struct WorldState
+{
+	Pt center;
+	Pt course;
+	double speed;
+	double wheels_angle;
+	WayPoint way_point;
+	std::array<Float, NA> last_action;
+	double last_reward;
+	unsigned episode;
+	unsigned steps;
+	unsigned stuck_steps;
+	double progress;
+	double start_arc;
+	Ending ending;
+};
+
+template <std::size_t NRAYS, std::size_t NA, typename Layout = UniformRays>
+struct World {
+	Car<NRAYS, Layout> car;
+	std::shared_ptr<const Track> track;
+	WayPoint way_point;
+	WayPoint old_way_point;
+	std::array<Float, NRAYS> state;
+	std::array<Float, NA> last_action;
+	double last_reward = 0;
+	unsigned episode = 0;
+
+	// Normalized state, written by recalc_state() straight into a row of
+	// the owner's network input buffer; see bind_input()
+	Float* input = nullptr;
+	const MinMax<NRAYS>* input_map = nullptr;
+	Float input_peak = 0;       // largest |input value|
+	double dist_reward = 0;     // term of reward() for the nearest wall
+
+	EpisodeLimits limits;
+	unsigned steps = 0;         // into the episode
+	unsigned stuck_steps = 0;   // in a row
+	double progress = 0;        // along the way since the episode started
+	double start_arc = 0;       // Way::arc() where the episode started
+	Ending ending = Ending::none; // set by the act() that ends the episode
+
+	explicit World(std::shared_ptr<const Track> atrack)
+		: car(atrack->way->start_center(), atrack->way->start_course(),
+			atrack->walls)
+	{
+		set_track(atrack);
+	}
+
+	// Puts the car at the start of the given track, standing still.
+	// Only pointers to the track change hands, nothing is rebuilt.
+	void set_track(std::shared_ptr<const Track> atrack)
+	{
+		track = std::move(atrack);
+		car.walls = track->walls;
+		car.grid = track->grid;
+		restart(track->way->start_center(), track->way->start_course());
+	}
+
+	// A new episode on the same track, standing still at the given pose
+	void restart(const Pt& center, const Pt& course)
+	{
+		car.speed = 0;
+		car.wheels_angle = 0;
+		place(center, course);
+		last_action.fill(0);
+		last_reward = 0;
+		episode++;
+	}
+
+	// restart() at arc length s along the way
+	void restart_at(double s)
+	{
+		Pt center, course;
+		track->way->pose_at(s, center, course);
+		restart(center, course);
+	}
+
+	// Moves the car to another pose on its track, e.g. a free spot of a
+	// shared arena. Counts as the start of an episode.
+	void place(const Pt& center, const Pt& course)
+	{
+		car.set_pos(center, course);
+		car.sense();
+		way_point = track->way->where_is(car.center);
+		old_way_point = way_point;
+		recalc_state();
+		steps = 0;
+		stuck_steps = 0;
+		progress = 0;
+		start_arc = track->way->arc(way_point);
+		ending = Ending::none;
+	}
+
+	// From now on the normalized state goes to row (NRAYS values). The
+	// row can be moved later by setting `input`; it is written on the
+	// next recalc_state().
+	void bind_input(Float* row, const MinMax<NRAYS>& map)
+	{
+		input = row;
+		input_map = &map;
+		recalc_state();
+	}
+
+	bool done() const
+	{
+		return ending != Ending::none;
+	}
+
+	WorldState<NA> save() const
+	{
+		static_assert(std::is_trivially_copyable<WorldState<NA>>::value,
+			"WorldState has to copy like plain bytes");
+		WorldState<NA> res;
+		res.center = car.center;
+		res.course = car.course;
+		res.speed = car.speed;
+		res.wheels_angle = car.wheels_angle;
+		res.way_point = way_point;
+		res.last_action = last_action;
+		res.last_reward = last_reward;
+		res.episode = episode;
+		res.steps = steps;
+		res.stuck_steps = stuck_steps;
+		res.progress = progress;
+		res.start_arc = start_arc;
+		res.ending = ending;
+		return res;
+	}
+
+	// Back to a state saved on the same track, by this world or another
+	// one. Moves the car in place and senses again, without allocating.
+	// A car in a shared arena moves there too, so fork from worlds of
+	// their own (see Rollouts).
+	void load(const WorldState<NA>& st)
+	{
+		car.set_pos(st.center, st.course);
+		car.speed = st.speed;
+		car.wheels_angle = st.wheels_angle;
+		car.sense();
+		way_point = st.way_point;
+		old_way_point = st.way_point;
+		recalc_state();
+		last_action = st.last_action;
+		last_reward = st.last_reward;
+		episode = st.episode;
+		steps = st.steps;
+		stuck_steps = st.stuck_steps;
+		progress = st.progress;
+		start_arc = st.start_arc;
+		ending = st.ending;
+	}
+
+	// Laps completed this episode: times the car crossed the start line
+	// forwards, less the times it crossed it backwards
+	int laps() const
+	{
+		return track->way->laps(start_arc, progress);
+	}
+
+	template <typename A>
+	void act(const A& action, double dt = 0.1)
+	{
+		TRACE_SCOPE("World::act");
+		const auto moved = car.act(action, dt);
+		old_way_point = way_point;
+		way_point = track->way->where_is(car.center, way_point, 32);
+		recalc_state();
+		std::copy(action.begin(), action.end(), last_action.begin());
+
+		// wedged: asked to drive and didn't move at all; scraping along a
+		// wall with the speed zeroed by the contact doesn't count
+		steps++;
+		stuck_steps = !moved && action[0] != 0 ? stuck_steps + 1 : 0;
+		progress += track->way->offset(old_way_point, way_point);
+		if(limits.stuck_steps > 0 && stuck_steps >= limits.stuck_steps) {
+			ending = Ending::stuck;
+		} else if(limits.wrong_way > 0 && progress <= -limits.wrong_way) {
+			ending = Ending::wrong_way;
+		} else if(limits.max_steps > 0 && steps >= limits.max_steps) {
+			ending = Ending::step_limit;
+		}
+	}
+
+	double reward() const
+	{
+		auto speed_reward = car.speed;
+		if(car.speed < 0) {
+			speed_reward = -car.speed/2.0;
+		}
+
+		auto wheels_reward = -car.wheels_angle*car.wheels_angle;
+
+		auto action_penalty = car.action_penalty3(last_action);
+		auto action_reward = -action_penalty*action_penalty;
+
+		auto speed_penalty = -car.speed*car.speed;		
+
+		return 10.0*speed_reward
+			+ 20.0*dist_reward
+			+ 5.0*wheels_reward
+			+ action_reward
+			+ 10.0*speed_penalty;
+	}
+
+	// One pass from the ray hits to everything made of them: the state
+	// (clamped to 10), its reward term and, once bound, the normalized
+	// network input with its peak for range checks
+	void recalc_state()
+	{
+		auto dist_term = 0.0;
+		auto peak = 0.0;
+		for(auto i = 0; i < NRAYS; i++) {
+			const auto s = std::min<Float>(car.dists[i], 10);
+			state[i] = s;
+			dist_term = std::min(dist_term, s * (1 - 0.0099 * s));
+			if(input) {
+				const auto x = s * input_map->scale[i] + input_map->shift[i];
+				input[i] = x;
+				peak = std::max(peak, std::fabs(x));
+			}
+		}
+		dist_reward = dist_term;
+		input_peak = peak;
+	}
+
+	constexpr std::size_t nrays() const noexcept
+	{
+		return NRAYS;
+	}
+};
+
+#endif